@@ -0,0 +1,149 @@
+// Times the ColorConvert kernels, scalar and simd, against swscale for the formats they cover,
+// at 1080p and 4K. The simd output is checked to be identical to the scalar one.
+//
+//   color_convert_bench [iterations]
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixfmt.h>
+#include <libswscale/swscale.h>
+}
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+
+#include "ColorConvert.h"
+
+struct Format {
+    const char* name;
+    AVPixelFormat pixelFormat;
+};
+
+static const Format FORMATS[] = {
+    {"nv12", AV_PIX_FMT_NV12},
+    {"i420", AV_PIX_FMT_YUV420P},
+    {"p010", AV_PIX_FMT_P010LE},
+};
+
+struct Size {
+    const char* name;
+    int width, height;
+};
+
+static const Size SIZES[] = {
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+};
+
+// a decoder-like frame of noise in the legal range, 64 byte aligned as decoders hand them out
+static AVFrame* makeFrame(AVPixelFormat format, int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    frame->colorspace = AVCOL_SPC_BT709;
+    frame->color_range = AVCOL_RANGE_MPEG;
+    if (av_frame_get_buffer(frame, 64) < 0) {
+        std::fprintf(stderr, "Couldn't allocate a %dx%d frame\n", width, height);
+        std::exit(1);
+    }
+
+    std::mt19937 random(1);
+    for (int plane = 0; plane < 3 && frame->data[plane]; ++plane) {
+        int rows = plane == 0 ? height : height / 2;
+        for (int row = 0; row < rows; ++row) {
+            uint8_t* line = frame->data[plane] + static_cast<ptrdiff_t>(row) * frame->linesize[plane];
+            if (format == AV_PIX_FMT_P010LE) {
+                auto* samples = reinterpret_cast<uint16_t*>(line);
+                for (int x = 0; x < frame->linesize[plane] / 2; ++x) {
+                    samples[x] = static_cast<uint16_t>((64 + random() % 877) << 6);
+                }
+            } else {
+                for (int x = 0; x < frame->linesize[plane]; ++x) {
+                    line[x] = static_cast<uint8_t>(16 + random() % 225);
+                }
+            }
+        }
+    }
+    return frame;
+}
+
+// milliseconds per frame, the best of the runs so other load on the machine counts least
+static double timeRuns(int iterations, const std::function<void()>& convert) {
+    convert();
+    double best = 1e30;
+    for (int i = 0; i < iterations; ++i) {
+        auto begin = std::chrono::steady_clock::now();
+        convert();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::max(1, std::atoi(argv[1])) : 50;
+    ColorConvert::setSimdEnabled(true);
+    std::string simdName = ColorConvert::backend();
+    bool haveSimd = simdName != "scalar";
+    bool mismatch = false;
+
+    std::printf("%-6s %-6s %10s %10s %10s %8s %8s\n",
+        "format", "size", "sws ms", "scalar ms", (simdName + " ms").c_str(), "scalar", simdName.c_str());
+    for (const auto& size : SIZES) {
+        for (const auto& format : FORMATS) {
+            AVFrame* frame = makeFrame(format.pixelFormat, size.width, size.height);
+            uint8_t* dst[4] = {};
+            int dstLinesize[4] = {};
+            uint8_t* reference[4] = {};
+            int referenceLinesize[4] = {};
+            av_image_alloc(dst, dstLinesize, size.width, size.height, AV_PIX_FMT_RGBA, 64);
+            av_image_alloc(reference, referenceLinesize, size.width, size.height, AV_PIX_FMT_RGBA, 64);
+
+            // the decoder's same-size fallback
+            SwsContext* swsCtx = sws_getContext(size.width, size.height, format.pixelFormat,
+                size.width, size.height, AV_PIX_FMT_RGBA, SWS_BICUBIC, nullptr, nullptr, nullptr);
+            double sws = timeRuns(iterations, [&] {
+                sws_scale(swsCtx, frame->data, frame->linesize, 0, size.height, dst, dstLinesize);
+            });
+            sws_freeContext(swsCtx);
+
+            ColorConvert::setSimdEnabled(false);
+            double scalar = timeRuns(iterations, [&] {
+                ColorConvert::convert(frame, reference[0], referenceLinesize[0], AV_PIX_FMT_RGBA);
+            });
+            ColorConvert::setSimdEnabled(true);
+
+            double simd = scalar;
+            if (haveSimd) {
+                simd = timeRuns(iterations, [&] {
+                    ColorConvert::convert(frame, dst[0], dstLinesize[0], AV_PIX_FMT_RGBA);
+                });
+                for (int row = 0; row < size.height; ++row) {
+                    if (std::memcmp(dst[0] + static_cast<ptrdiff_t>(row) * dstLinesize[0],
+                        reference[0] + static_cast<ptrdiff_t>(row) * referenceLinesize[0], size.width * 4) != 0) {
+                        std::printf("%s %s: %s output differs from scalar in row %d\n",
+                            format.name, size.name, simdName.c_str(), row);
+                        mismatch = true;
+                        break;
+                    }
+                }
+            }
+
+            // the last two columns are the speedup over swscale
+            std::printf("%-6s %-6s %10.2f %10.2f %10.2f %7.1fx %7.1fx\n",
+                format.name, size.name, sws, scalar, simd, sws / scalar, sws / simd);
+
+            av_freep(&dst[0]);
+            av_freep(&reference[0]);
+            av_frame_free(&frame);
+        }
+    }
+    return mismatch ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+# Soak benchmark: loops a short clip with -r for hours and checks the player's resident memory
+# stays flat, a leak of a packet or frame per loop shows up as steady growth.
+#
+#   soak.py <player> [--fixture clip.mp4] [--hours 3] [--max-drift 16]
+#
+# The baseline is the highest RSS over the first --warmup minutes, caches and pools fill up
+# during those. Exits 0 when no later sample is more than --max-drift MB above it, 1 otherwise
+# and 77 when it can't run here (no display, no ffmpeg to make a clip with).
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SKIP = 77
+
+
+def make_fixture(directory):
+    ffmpeg = shutil.which("ffmpeg")
+    if ffmpeg is None:
+        return None
+    path = os.path.join(directory, "soak.mp4")
+    subprocess.run([ffmpeg, "-v", "error", "-y",
+                    "-f", "lavfi", "-i", "testsrc2=size=1280x720:rate=30",
+                    "-f", "lavfi", "-i", "sine=frequency=440:sample_rate=48000",
+                    "-t", "20", "-pix_fmt", "yuv420p", "-g", "60", "-shortest", path],
+                   check=True)
+    return path
+
+
+def rss_mb(pid):
+    try:
+        with open(f"/proc/{pid}/status") as status:
+            for line in status:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1]) / 1024.0
+    except OSError:
+        pass
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("player")
+    parser.add_argument("--fixture")
+    parser.add_argument("--hours", type=float, default=3.0)
+    parser.add_argument("--warmup", type=float, default=5.0, help="minutes")
+    parser.add_argument("--max-drift", type=float, default=16.0, help="MB")
+    parser.add_argument("--interval", type=float, default=10.0, help="seconds between samples")
+    args = parser.parse_args()
+
+    if not os.environ.get("DISPLAY") and not os.environ.get("WAYLAND_DISPLAY"):
+        print("soak: no display to open the player window on, skipped")
+        return SKIP
+
+    with tempfile.TemporaryDirectory() as directory:
+        fixture = args.fixture or make_fixture(directory)
+        if fixture is None:
+            print("soak: no --fixture and no ffmpeg to make one, skipped")
+            return SKIP
+
+        # printf output is block buffered into a pipe, line buffering gets each loop as it happens
+        command = [args.player, fixture, "-r"]
+        if shutil.which("stdbuf"):
+            command = ["stdbuf", "-oL"] + command
+        player = subprocess.Popen(command, stdout=subprocess.PIPE,
+                                  stderr=subprocess.STDOUT, text=True)
+        loops = 0
+
+        def count_loops():
+            nonlocal loops
+            for line in player.stdout:
+                if line.startswith("Play again"):
+                    loops += 1
+
+        threading.Thread(target=count_loops, daemon=True).start()
+
+        begin = time.monotonic()
+        end = begin + args.hours * 3600
+        baseline = peak = 0.0
+        failed = False
+        try:
+            while time.monotonic() < end:
+                time.sleep(args.interval)
+                if player.poll() is not None:
+                    print(f"soak: player exited with {player.returncode} after {loops} loops")
+                    failed = True
+                    break
+                rss = rss_mb(player.pid)
+                if rss is None:
+                    continue
+                elapsed = time.monotonic() - begin
+                if elapsed < args.warmup * 60:
+                    baseline = max(baseline, rss)
+                    continue
+                peak = max(peak, rss)
+                print(f"{elapsed / 60:7.1f} min  loop {loops:5d}  rss {rss:7.1f} MB  "
+                      f"drift {rss - baseline:+6.1f} MB", flush=True)
+                if rss - baseline > args.max_drift:
+                    print(f"soak: rss grew {rss - baseline:.1f} MB over the {baseline:.1f} MB baseline")
+                    failed = True
+                    break
+        finally:
+            player.terminate()
+            try:
+                player.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                player.kill()
+
+    if not failed and loops < 2:
+        print(f"soak: only {loops} loops, the clip doesn't replay")
+        failed = True
+    if not failed:
+        print(f"soak: {loops} loops, rss {baseline:.1f} MB baseline, {peak:.1f} MB peak")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,141 @@
+#include "AudioTempo.h"
+
+extern "C"
+{
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/frame.h>
+#include <libavutil/mem.h>
+#include <libavutil/opt.h>
+}
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+AudioTempo::AudioTempo(int sampleRate, const AVChannelLayout& channelLayout, AVSampleFormat sampleFormat, double speed)
+    : sampleRate(sampleRate), sampleFormat(sampleFormat), speed_(speed) {
+    av_channel_layout_copy(&this->channelLayout, &channelLayout);
+
+    graph = avfilter_graph_alloc();
+    if (graph == nullptr) {
+        return;
+    }
+    char layout[64];
+    av_channel_layout_describe(&channelLayout, layout, sizeof(layout));
+    char args[256];
+    std::snprintf(args, sizeof(args), "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+        sampleRate, sampleRate, av_get_sample_fmt_name(sampleFormat), layout);
+    if (avfilter_graph_create_filter(&source, avfilter_get_by_name("abuffer"), "in", args, nullptr, graph) < 0) {
+        avfilter_graph_free(&graph);
+        return;
+    }
+
+    // the output is copied out as packed samples of the input format, atempo would otherwise be
+    // free to hand back whatever format it prefers
+    const AVSampleFormat sampleFormats[] = {sampleFormat, AV_SAMPLE_FMT_NONE};
+    const int sampleRates[] = {sampleRate, -1};
+    sink = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("abuffersink"), "out");
+    if (sink == nullptr
+        || av_opt_set_int_list(sink, "sample_fmts", sampleFormats, AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN) < 0
+        || av_opt_set(sink, "ch_layouts", layout, AV_OPT_SEARCH_CHILDREN) < 0
+        || av_opt_set_int_list(sink, "sample_rates", sampleRates, -1, AV_OPT_SEARCH_CHILDREN) < 0
+        || avfilter_init_str(sink, nullptr) < 0) {
+        avfilter_graph_free(&graph);
+        return;
+    }
+
+    // a single atempo covers 0.5x to 100x
+    std::string description;
+    double remaining = speed;
+    while (remaining < 0.5) {
+        description += "atempo=0.5,";
+        remaining /= 0.5;
+    }
+    description += "atempo=" + std::to_string(remaining);
+
+    AVFilterInOut* outputs = avfilter_inout_alloc();
+    AVFilterInOut* inputs = avfilter_inout_alloc();
+    outputs->name = av_strdup("in");
+    outputs->filter_ctx = source;
+    outputs->pad_idx = 0;
+    outputs->next = nullptr;
+    inputs->name = av_strdup("out");
+    inputs->filter_ctx = sink;
+    inputs->pad_idx = 0;
+    inputs->next = nullptr;
+    int ret = avfilter_graph_parse_ptr(graph, description.c_str(), &inputs, &outputs, nullptr);
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+    if (ret < 0 || avfilter_graph_config(graph, nullptr) < 0) {
+        avfilter_graph_free(&graph);
+    }
+}
+
+AudioTempo::~AudioTempo() {
+    avfilter_graph_free(&graph);
+    av_channel_layout_uninit(&channelLayout);
+}
+
+bool AudioTempo::valid() const {
+    return graph != nullptr;
+}
+
+double AudioTempo::speed() const {
+    return speed_;
+}
+
+bool AudioTempo::process(const uint8_t* data, int samples, int64_t pts, std::vector<Chunk>& out) {
+    if (graph == nullptr || flushed) {
+        return false;
+    }
+    if (startPts == AV_NOPTS_VALUE) {
+        startPts = pts;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    frame->nb_samples = samples;
+    frame->format = sampleFormat;
+    frame->sample_rate = sampleRate;
+    av_channel_layout_copy(&frame->ch_layout, &channelLayout);
+    frame->pts = pts;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return false;
+    }
+    std::memcpy(frame->data[0], data, static_cast<size_t>(av_samples_get_buffer_size(
+        nullptr, channelLayout.nb_channels, samples, sampleFormat, 1)));
+    int ret = av_buffersrc_add_frame(source, frame);
+    av_frame_free(&frame);
+    if (ret < 0) {
+        return false;
+    }
+    collect(out);
+    return true;
+}
+
+bool AudioTempo::flush(std::vector<Chunk>& out) {
+    if (graph == nullptr || flushed) {
+        return false;
+    }
+    flushed = true;
+    if (av_buffersrc_add_frame(source, nullptr) < 0) {
+        return false;
+    }
+    collect(out);
+    return true;
+}
+
+void AudioTempo::collect(std::vector<Chunk>& out) {
+    AVFrame* filtered = av_frame_alloc();
+    while (av_buffersink_get_frame(sink, filtered) >= 0) {
+        int size = av_samples_get_buffer_size(nullptr, channelLayout.nb_channels, filtered->nb_samples, sampleFormat, 1);
+        auto* chunk = static_cast<uint8_t*>(av_malloc(static_cast<size_t>(size)));
+        std::memcpy(chunk, filtered->data[0], static_cast<size_t>(size));
+        // every output sample stands for speed input samples, counted from the first input
+        out.push_back({chunk, size, filtered->nb_samples, startPts + std::llround(samplesOut * speed_)});
+        samplesOut += filtered->nb_samples;
+        av_frame_unref(filtered);
+    }
+    av_frame_free(&filtered);
+}
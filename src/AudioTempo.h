@@ -0,0 +1,63 @@
+#ifndef VK_SDL2_VP_AUDIOTEMPO_H
+#define VK_SDL2_VP_AUDIOTEMPO_H
+
+extern "C"
+{
+#include <libavfilter/avfilter.h>
+#include <libavutil/avutil.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+}
+#include <cstdint>
+#include <vector>
+
+// Pitch preserving time stretch of converted PCM through libavfilter's atempo, chained for
+// speeds below 0.5x. Input and output are packed samples in the output device's format;
+// the filter delays its output by a window, output positions are mapped back onto the input.
+class AudioTempo {
+public:
+    struct Chunk {
+        // av_malloc'd, the caller takes ownership
+        uint8_t* data;
+        int size;
+        int samples;
+        // position in the input, in samples
+        int64_t pts;
+    };
+
+    AudioTempo(int sampleRate, const AVChannelLayout& channelLayout, AVSampleFormat sampleFormat, double speed);
+    ~AudioTempo();
+
+    AudioTempo(const AudioTempo&) = delete;
+    AudioTempo& operator=(const AudioTempo&) = delete;
+
+    // false when the filter graph couldn't be set up
+    bool valid() const;
+
+    double speed() const;
+
+    // feeds samples starting at input position pts and appends whatever the filter puts out
+    bool process(const uint8_t* data, int samples, int64_t pts, std::vector<Chunk>& out);
+
+    // ends the input and appends the window the filter still holds, nothing can be fed after it
+    bool flush(std::vector<Chunk>& out);
+
+private:
+    int sampleRate;
+    AVChannelLayout channelLayout{};
+    AVSampleFormat sampleFormat;
+    double speed_;
+
+    AVFilterGraph* graph = nullptr;
+    AVFilterContext* source = nullptr;
+    AVFilterContext* sink = nullptr;
+
+    int64_t startPts = AV_NOPTS_VALUE;
+    int64_t samplesOut = 0;
+    bool flushed = false;
+
+    void collect(std::vector<Chunk>& out);
+};
+
+
+#endif //VK_SDL2_VP_AUDIOTEMPO_H
@@ -0,0 +1,115 @@
+#include "CacheDir.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+std::filesystem::path CacheDir::get(const std::string& subDir) {
+    std::filesystem::path dir;
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+        dir = xdg;
+    } else if (const char* home = std::getenv("HOME"); home && *home) {
+        dir = std::filesystem::path(home) / ".cache";
+    } else {
+        return {};
+    }
+    dir /= "vk_sdl2_vp";
+    if (!subDir.empty()) {
+        dir /= subDir;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        return {};
+    }
+    return dir;
+}
+
+bool CacheDir::readFile(const std::filesystem::path& path, std::vector<char>& data) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    auto size = file.tellg();
+    if (size <= 0) {
+        return false;
+    }
+    data.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    return static_cast<bool>(file.read(data.data(), size));
+}
+
+bool CacheDir::writeFile(const std::filesystem::path& path, const void* data, size_t size) {
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file || !file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size))) {
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+std::string CacheDir::keyName(const std::string& key) {
+    // FNV-1a, stable across runs and standard library implementations
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return name;
+}
+
+std::string CacheDir::fileKey(const std::string& filename) {
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(filename, ec)) {
+        return {};
+    }
+    auto absolutePath = std::filesystem::absolute(filename, ec);
+    auto size = std::filesystem::file_size(filename, ec);
+    auto mtime = std::filesystem::last_write_time(filename, ec);
+    if (ec) {
+        return {};
+    }
+    return absolutePath.string() + "|" + std::to_string(size) + "|" + std::to_string(mtime.time_since_epoch().count());
+}
+
+void CacheDir::trim(const std::filesystem::path& dir, uintmax_t maxBytes) {
+    struct File {
+        std::filesystem::path path;
+        uintmax_t size;
+        std::filesystem::file_time_type mtime;
+    };
+    std::vector<File> files;
+    uintmax_t total = 0;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::error_code entryEc;
+        if (!entry.is_regular_file(entryEc)) {
+            continue;
+        }
+        File file{entry.path(), entry.file_size(entryEc), entry.last_write_time(entryEc)};
+        if (!entryEc) {
+            total += file.size;
+            files.push_back(std::move(file));
+        }
+    }
+
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.mtime < b.mtime; });
+    for (const auto& file : files) {
+        if (total <= maxBytes) {
+            break;
+        }
+        if (std::filesystem::remove(file.path, ec)) {
+            total -= file.size;
+        }
+    }
+}
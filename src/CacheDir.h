@@ -0,0 +1,31 @@
+#ifndef VK_SDL2_VP_CACHEDIR_H
+#define VK_SDL2_VP_CACHEDIR_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Per-user cache directory: $XDG_CACHE_HOME/vk_sdl2_vp, falling back to ~/.cache/vk_sdl2_vp.
+class CacheDir {
+public:
+    // returns an empty path if no usable cache directory exists
+    static std::filesystem::path get(const std::string& subDir = "");
+
+    static bool readFile(const std::filesystem::path& path, std::vector<char>& data);
+
+    // writes to a temporary file first, so a crash never leaves a truncated cache entry behind
+    static bool writeFile(const std::filesystem::path& path, const void* data, size_t size);
+
+    // hex digest of the key, usable as a file name
+    static std::string keyName(const std::string& key);
+
+    // identity of a local file (absolute path, size and mtime), empty for anything that isn't a regular file
+    static std::string fileKey(const std::string& filename);
+
+    // removes the least recently written files of dir until the rest fit in maxBytes
+    static void trim(const std::filesystem::path& dir, uintmax_t maxBytes);
+};
+
+
+#endif //VK_SDL2_VP_CACHEDIR_H
@@ -0,0 +1,381 @@
+#include "ColorConvert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COLOR_CONVERT_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define COLOR_CONVERT_NEON 1
+#endif
+
+namespace {
+
+enum class SourceFormat {
+    NV12,
+    I420,
+    P010
+};
+
+template <SourceFormat F>
+struct FormatTraits {
+    using Sample = std::conditional_t<F == SourceFormat::P010, uint16_t, uint8_t>;
+    // chroma interleaved in one plane (NV12, P010) or in two planes (I420)
+    static constexpr bool semiPlanar = F != SourceFormat::I420;
+    static constexpr int bits = F == SourceFormat::P010 ? 10 : 8;
+    // P010 keeps its 10 bits in the high end of each 16 bit sample
+    static constexpr int sampleShift = F == SourceFormat::P010 ? 6 : 0;
+
+    static constexpr int yOffset = 16 << (bits - 8);
+    static constexpr int cOffset = 128 << (bits - 8);
+    // fixed point coefficients have 13 fraction bits, higher depths are scaled down to 8 bits as well
+    static constexpr int shift = 13 + (bits - 8);
+    static constexpr int round = 1 << (shift - 1);
+};
+
+// limited range, Q13
+struct Coefficients {
+    int cy, crv, cgu, cgv, cbu;
+};
+
+constexpr Coefficients COEFFICIENTS[] = {
+    {9539, 13075, 3209, 6660, 16525}, // BT.601
+    {9539, 14686, 1747, 4366, 17305}, // BT.709
+    {9539, 13752, 1535, 5328, 17545}, // BT.2020
+};
+
+template <SourceFormat F>
+struct Row {
+    using Sample = typename FormatTraits<F>::Sample;
+    const Sample* y;
+    // the interleaved UV plane for semi-planar formats, v is unused then
+    const Sample* u;
+    const Sample* v;
+};
+
+template <SourceFormat F, ColorConvert::Matrix M, bool BGRA>
+void convertRowScalar(const Row<F>& row, uint8_t* dst, int begin, int end) {
+    using T = FormatTraits<F>;
+    constexpr Coefficients c = COEFFICIENTS[static_cast<int>(M)];
+
+    for (int x = begin; x < end; ++x) {
+        int y = ((row.y[x] >> T::sampleShift) - T::yOffset) * c.cy + T::round;
+        int u, v;
+        if constexpr (T::semiPlanar) {
+            u = (row.u[(x >> 1) * 2] >> T::sampleShift) - T::cOffset;
+            v = (row.u[(x >> 1) * 2 + 1] >> T::sampleShift) - T::cOffset;
+        } else {
+            u = row.u[x >> 1] - T::cOffset;
+            v = row.v[x >> 1] - T::cOffset;
+        }
+
+        int r = std::clamp((y + c.crv * v) >> T::shift, 0, 255);
+        int g = std::clamp((y - c.cgu * u - c.cgv * v) >> T::shift, 0, 255);
+        int b = std::clamp((y + c.cbu * u) >> T::shift, 0, 255);
+
+        uint8_t* pixel = dst + x * 4;
+        pixel[BGRA ? 2 : 0] = static_cast<uint8_t>(r);
+        pixel[1] = static_cast<uint8_t>(g);
+        pixel[BGRA ? 0 : 2] = static_cast<uint8_t>(b);
+        pixel[3] = 255;
+    }
+}
+
+#ifdef COLOR_CONVERT_AVX2
+// 8 pixels per step in 32 bit lanes, returns the number of pixels done
+template <SourceFormat F, ColorConvert::Matrix M, bool BGRA>
+__attribute__((target("avx2")))
+int convertRowAvx2(const Row<F>& row, uint8_t* dst, int width) {
+    using T = FormatTraits<F>;
+    constexpr Coefficients c = COEFFICIENTS[static_cast<int>(M)];
+
+    const __m256i yOffset = _mm256_set1_epi32(T::yOffset);
+    const __m256i cOffset = _mm256_set1_epi32(T::cOffset);
+    const __m256i round = _mm256_set1_epi32(T::round);
+    const __m256i cy = _mm256_set1_epi32(c.cy);
+    const __m256i crv = _mm256_set1_epi32(c.crv);
+    const __m256i cgu = _mm256_set1_epi32(c.cgu);
+    const __m256i cgv = _mm256_set1_epi32(c.cgv);
+    const __m256i cbu = _mm256_set1_epi32(c.cbu);
+    const __m256i alpha = _mm256_set1_epi32(255);
+    // each chroma sample covers two pixels
+    const __m256i duplicate = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i evenLanes = _mm256_setr_epi32(0, 0, 2, 2, 4, 4, 6, 6);
+    const __m256i oddLanes = _mm256_setr_epi32(1, 1, 3, 3, 5, 5, 7, 7);
+    // per 128 bit lane the packed bytes are RRRR GGGG BBBB AAAA, interleave them into pixels
+    const __m256i interleave = _mm256_setr_epi8(
+        0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+        0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i luma, u, v;
+        if constexpr (F == SourceFormat::P010) {
+            luma = _mm256_srli_epi32(_mm256_cvtepu16_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.y + x))), T::sampleShift);
+            __m256i uv = _mm256_srli_epi32(_mm256_cvtepu16_epi32(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(row.u + x))), T::sampleShift);
+            u = _mm256_permutevar8x32_epi32(uv, evenLanes);
+            v = _mm256_permutevar8x32_epi32(uv, oddLanes);
+        } else {
+            luma = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row.y + x)));
+            if constexpr (T::semiPlanar) {
+                __m256i uv = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row.u + x)));
+                u = _mm256_permutevar8x32_epi32(uv, evenLanes);
+                v = _mm256_permutevar8x32_epi32(uv, oddLanes);
+            } else {
+                int32_t u4, v4;
+                std::memcpy(&u4, row.u + x / 2, sizeof(u4));
+                std::memcpy(&v4, row.v + x / 2, sizeof(v4));
+                u = _mm256_permutevar8x32_epi32(_mm256_cvtepu8_epi32(_mm_cvtsi32_si128(u4)), duplicate);
+                v = _mm256_permutevar8x32_epi32(_mm256_cvtepu8_epi32(_mm_cvtsi32_si128(v4)), duplicate);
+            }
+        }
+
+        __m256i y = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(luma, yOffset), cy), round);
+        u = _mm256_sub_epi32(u, cOffset);
+        v = _mm256_sub_epi32(v, cOffset);
+
+        __m256i r = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_mullo_epi32(v, crv)), T::shift);
+        __m256i g = _mm256_srai_epi32(_mm256_sub_epi32(y,
+            _mm256_add_epi32(_mm256_mullo_epi32(u, cgu), _mm256_mullo_epi32(v, cgv))), T::shift);
+        __m256i b = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_mullo_epi32(u, cbu)), T::shift);
+
+        // the saturating packs clamp to 0..255
+        __m256i first = _mm256_packs_epi32(BGRA ? b : r, g);
+        __m256i second = _mm256_packs_epi32(BGRA ? r : b, alpha);
+        __m256i pixels = _mm256_shuffle_epi8(_mm256_packus_epi16(first, second), interleave);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), pixels);
+    }
+    return x;
+}
+
+bool cpuHasAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+#ifdef COLOR_CONVERT_NEON
+template <SourceFormat F, ColorConvert::Matrix M>
+inline uint8x8x3_t neonPixels8(uint16x8_t luma, uint16x8_t u16, uint16x8_t v16) {
+    using T = FormatTraits<F>;
+    constexpr Coefficients c = COEFFICIENTS[static_cast<int>(M)];
+
+    uint8x8x3_t rgb;
+    int16x4_t r[2], g[2], b[2];
+    for (int half = 0; half < 2; ++half) {
+        uint16x4_t l = half ? vget_high_u16(luma) : vget_low_u16(luma);
+        uint16x4_t cu = half ? vget_high_u16(u16) : vget_low_u16(u16);
+        uint16x4_t cv = half ? vget_high_u16(v16) : vget_low_u16(v16);
+
+        int32x4_t y = vreinterpretq_s32_u32(vmovl_u16(l));
+        y = vaddq_s32(vmulq_n_s32(vsubq_s32(y, vdupq_n_s32(T::yOffset)), c.cy), vdupq_n_s32(T::round));
+        int32x4_t u = vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(cu)), vdupq_n_s32(T::cOffset));
+        int32x4_t v = vsubq_s32(vreinterpretq_s32_u32(vmovl_u16(cv)), vdupq_n_s32(T::cOffset));
+
+        r[half] = vqmovn_s32(vshrq_n_s32(vmlaq_n_s32(y, v, c.crv), T::shift));
+        g[half] = vqmovn_s32(vshrq_n_s32(vmlsq_n_s32(vmlsq_n_s32(y, u, c.cgu), v, c.cgv), T::shift));
+        b[half] = vqmovn_s32(vshrq_n_s32(vmlaq_n_s32(y, u, c.cbu), T::shift));
+    }
+    // saturating narrows clamp to 0..255
+    rgb.val[0] = vqmovun_s16(vcombine_s16(r[0], r[1]));
+    rgb.val[1] = vqmovun_s16(vcombine_s16(g[0], g[1]));
+    rgb.val[2] = vqmovun_s16(vcombine_s16(b[0], b[1]));
+    return rgb;
+}
+
+// 16 pixels per step, returns the number of pixels done
+template <SourceFormat F, ColorConvert::Matrix M, bool BGRA>
+int convertRowNeon(const Row<F>& row, uint8_t* dst, int width) {
+    using T = FormatTraits<F>;
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint16x8_t y0, y1, u, v;
+        if constexpr (F == SourceFormat::P010) {
+            y0 = vshrq_n_u16(vld1q_u16(row.y + x), T::sampleShift);
+            y1 = vshrq_n_u16(vld1q_u16(row.y + x + 8), T::sampleShift);
+            uint16x8x2_t uv = vld2q_u16(row.u + x);
+            u = vshrq_n_u16(uv.val[0], T::sampleShift);
+            v = vshrq_n_u16(uv.val[1], T::sampleShift);
+        } else {
+            uint8x16_t luma = vld1q_u8(row.y + x);
+            y0 = vmovl_u8(vget_low_u8(luma));
+            y1 = vmovl_u8(vget_high_u8(luma));
+            if constexpr (T::semiPlanar) {
+                uint8x8x2_t uv = vld2_u8(row.u + x);
+                u = vmovl_u8(uv.val[0]);
+                v = vmovl_u8(uv.val[1]);
+            } else {
+                u = vmovl_u8(vld1_u8(row.u + x / 2));
+                v = vmovl_u8(vld1_u8(row.v + x / 2));
+            }
+        }
+
+        // each chroma sample covers two pixels
+        uint16x8x2_t uu = vzipq_u16(u, u);
+        uint16x8x2_t vv = vzipq_u16(v, v);
+        uint8x8x3_t low = neonPixels8<F, M>(y0, uu.val[0], vv.val[0]);
+        uint8x8x3_t high = neonPixels8<F, M>(y1, uu.val[1], vv.val[1]);
+
+        uint8x16x4_t pixels;
+        pixels.val[BGRA ? 2 : 0] = vcombine_u8(low.val[0], high.val[0]);
+        pixels.val[1] = vcombine_u8(low.val[1], high.val[1]);
+        pixels.val[BGRA ? 0 : 2] = vcombine_u8(low.val[2], high.val[2]);
+        pixels.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + x * 4, pixels);
+    }
+    return x;
+}
+#endif
+
+using RowKernel = void (*)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width);
+
+template <SourceFormat F, ColorConvert::Matrix M, bool BGRA, bool SIMD>
+void convertRow(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int width) {
+    using Sample = typename FormatTraits<F>::Sample;
+    Row<F> row = {
+        reinterpret_cast<const Sample*>(y), reinterpret_cast<const Sample*>(u), reinterpret_cast<const Sample*>(v)
+    };
+
+    int x = 0;
+    if constexpr (SIMD) {
+#if defined(COLOR_CONVERT_AVX2)
+        x = convertRowAvx2<F, M, BGRA>(row, dst, width);
+#elif defined(COLOR_CONVERT_NEON)
+        x = convertRowNeon<F, M, BGRA>(row, dst, width);
+#endif
+    }
+    // the remainder of the row
+    convertRowScalar<F, M, BGRA>(row, dst, x, width);
+}
+
+template <SourceFormat F, ColorConvert::Matrix M>
+RowKernel selectKernel(bool bgra, bool simd) {
+    if (bgra) {
+        return simd ? convertRow<F, M, true, true> : convertRow<F, M, true, false>;
+    }
+    return simd ? convertRow<F, M, false, true> : convertRow<F, M, false, false>;
+}
+
+template <SourceFormat F>
+RowKernel selectKernel(ColorConvert::Matrix matrix, bool bgra, bool simd) {
+    switch (matrix) {
+        case ColorConvert::Matrix::BT601:
+            return selectKernel<F, ColorConvert::Matrix::BT601>(bgra, simd);
+        case ColorConvert::Matrix::BT709:
+            return selectKernel<F, ColorConvert::Matrix::BT709>(bgra, simd);
+        case ColorConvert::Matrix::BT2020:
+            return selectKernel<F, ColorConvert::Matrix::BT2020>(bgra, simd);
+    }
+    return nullptr;
+}
+
+std::atomic<bool> simdEnabled = true;
+
+bool simdAvailable() {
+    if (!simdEnabled) {
+        return false;
+    }
+#if defined(COLOR_CONVERT_AVX2)
+    return cpuHasAvx2();
+#elif defined(COLOR_CONVERT_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool sourceMatrix(const AVFrame* frame, ColorConvert::Matrix& matrix) {
+    switch (frame->colorspace) {
+        case AVCOL_SPC_BT470BG:
+        case AVCOL_SPC_SMPTE170M:
+            matrix = ColorConvert::Matrix::BT601;
+            return true;
+        case AVCOL_SPC_BT709:
+            matrix = ColorConvert::Matrix::BT709;
+            return true;
+        case AVCOL_SPC_BT2020_NCL:
+            matrix = ColorConvert::Matrix::BT2020;
+            return true;
+        case AVCOL_SPC_UNSPECIFIED:
+            // the usual guess, HD is 709
+            matrix = frame->height >= 720 ? ColorConvert::Matrix::BT709 : ColorConvert::Matrix::BT601;
+            return true;
+        default:
+            return false;
+    }
+}
+
+RowKernel findKernel(const AVFrame* frame, AVPixelFormat dstFormat) {
+    if (dstFormat != AV_PIX_FMT_RGBA && dstFormat != AV_PIX_FMT_BGRA) {
+        return nullptr;
+    }
+    // full range sources are left to swscale
+    if (frame->color_range == AVCOL_RANGE_JPEG) {
+        return nullptr;
+    }
+    ColorConvert::Matrix matrix;
+    if (!sourceMatrix(frame, matrix)) {
+        return nullptr;
+    }
+
+    bool bgra = dstFormat == AV_PIX_FMT_BGRA;
+    bool simd = simdAvailable();
+    switch (frame->format) {
+        case AV_PIX_FMT_NV12:
+            return selectKernel<SourceFormat::NV12>(matrix, bgra, simd);
+        case AV_PIX_FMT_YUV420P:
+            return selectKernel<SourceFormat::I420>(matrix, bgra, simd);
+        case AV_PIX_FMT_P010LE:
+            return selectKernel<SourceFormat::P010>(matrix, bgra, simd);
+        default:
+            return nullptr;
+    }
+}
+
+}
+
+bool ColorConvert::supported(const AVFrame* frame, AVPixelFormat dstFormat) {
+    return findKernel(frame, dstFormat) != nullptr;
+}
+
+bool ColorConvert::convert(const AVFrame* frame, uint8_t* dst, int dstLinesize, AVPixelFormat dstFormat) {
+    RowKernel kernel = findKernel(frame, dstFormat);
+    if (kernel == nullptr) {
+        return false;
+    }
+
+    // 4:2:0, a chroma row covers two rows
+    bool semiPlanar = frame->format != AV_PIX_FMT_YUV420P;
+    for (int row = 0; row < frame->height; ++row) {
+        const uint8_t* y = frame->data[0] + static_cast<ptrdiff_t>(row) * frame->linesize[0];
+        const uint8_t* u = frame->data[1] + static_cast<ptrdiff_t>(row / 2) * frame->linesize[1];
+        const uint8_t* v = semiPlanar ? nullptr : frame->data[2] + static_cast<ptrdiff_t>(row / 2) * frame->linesize[2];
+        kernel(y, u, v, dst + static_cast<ptrdiff_t>(row) * dstLinesize, frame->width);
+    }
+    return true;
+}
+
+const char* ColorConvert::backend() {
+    if (!simdAvailable()) {
+        return "scalar";
+    }
+#if defined(COLOR_CONVERT_AVX2)
+    return "avx2";
+#elif defined(COLOR_CONVERT_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+void ColorConvert::setSimdEnabled(bool enabled) {
+    simdEnabled = enabled;
+}
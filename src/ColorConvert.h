@@ -0,0 +1,37 @@
+#ifndef VK_SDL2_VP_COLORCONVERT_H
+#define VK_SDL2_VP_COLORCONVERT_H
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+#include <cstdint>
+
+// Same-size YUV to RGBA/BGRA conversion for the common decoder outputs (NV12, I420, P010,
+// limited range BT.601/709/2020). Row kernels are specialised per source format, matrix and
+// output order at compile time, with an AVX2 or NEON variant picked at runtime.
+// Anything else, scaling included, is left to swscale.
+class ColorConvert {
+public:
+    enum class Matrix {
+        BT601,
+        BT709,
+        BT2020
+    };
+
+    // whether convert can handle this frame, dstFormat is AV_PIX_FMT_RGBA or AV_PIX_FMT_BGRA
+    static bool supported(const AVFrame* frame, AVPixelFormat dstFormat);
+
+    // converts the whole frame into dst at the frame's own size, false if not supported
+    static bool convert(const AVFrame* frame, uint8_t* dst, int dstLinesize, AVPixelFormat dstFormat);
+
+    // name of the kernels in use on this cpu: "avx2", "neon" or "scalar"
+    static const char* backend();
+
+    // false forces the scalar kernels, for comparing them in the benchmark
+    static void setSimdEnabled(bool enabled);
+};
+
+
+#endif //VK_SDL2_VP_COLORCONVERT_H
@@ -3,13 +3,22 @@
 //
 
 #include "FFmpegDecoder.h"
+#include "SeekPrefetcher.h"
+#include "ColorConvert.h"
+#include "LoopCache.h"
+#include "GopCache.h"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <SDL_cpuinfo.h>
 #include <stdexcept>
 #include <bits/ostream.tcc>
+#include <cstdio>
+#include <sys/stat.h>
 
 
 static std::map<SDL_AudioFormat, AVSampleFormat> AUDIO_FORMAT_MAP = {
@@ -20,28 +29,107 @@ static std::map<SDL_AudioFormat, AVSampleFormat> AUDIO_FORMAT_MAP = {
     {AUDIO_F32SYS, AV_SAMPLE_FMT_FLT}
 };
 
-FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& audio_spec, bool replay) {
+bool FFmpegDecoder::isLiveSource(const std::string& filename) {
+    if (filename == "-" || filename.rfind("pipe:", 0) == 0) {
+        return true;
+    }
+    for (const char* protocol : {"udp://", "rtp://", "srt://"}) {
+        if (filename.rfind(protocol, 0) == 0) {
+            return true;
+        }
+    }
+    struct stat st = {};
+    return stat(filename.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& audio_spec, const DecoderConfig& config) {
     this->filename = filename;
-    this->replay = replay;
-    videoDecoder.setMaxFrameSize(5);
-    audioDecoder.setMaxFrameSize(10);
+    this->replay = config.replay;
+    live = config.live || isLiveSource(filename);
+    // live input arrives in real time, it can't be played faster or slower
+    speed = live ? 1.0 : std::clamp(config.speed, MIN_SPEED, MAX_SPEED);
+    appliedSpeed = speed;
+    // every queued frame is latency for live input
+    videoDecoder.setMaxFrameSize(live ? 2 : 5);
+    audioDecoder.setMaxFrameSize(live ? 4 : 10);
 
     bool hasVideo = false, hasAudio = false;
 
     // alloc AVFormatCtx
     pFormatCtx = avformat_alloc_context();
 
+    // probe limits
+    AVDictionary* formatOptions = nullptr;
+    if (config.probeSize > 0) {
+        av_dict_set_int(&formatOptions, "probesize", config.probeSize, 0);
+    }
+    if (config.analyzeDuration > 0) {
+        av_dict_set_int(&formatOptions, "analyzeduration", config.analyzeDuration, 0);
+    }
+
+    // live input starts from whatever arrives first, probing only as much as it takes to find the codecs
+    if (live) {
+        if (config.probeSize <= 0) {
+            av_dict_set_int(&formatOptions, "probesize", 32 * 1024, 0);
+        }
+        if (config.analyzeDuration <= 0) {
+            av_dict_set_int(&formatOptions, "analyzeduration", 100000, 0);
+        }
+        av_dict_set(&formatOptions, "overrun_nonfatal", "1", 0);
+        pFormatCtx->flags |= AVFMT_FLAG_NOBUFFER | AVFMT_FLAG_FLUSH_PACKETS;
+        liveLatency.max = config.maxLatency;
+        videoDecoder.packetQueue.set_max_size(16);
+        audioDecoder.packetQueue.set_max_size(16);
+    }
+
+    // urls get ffmpeg's reconnect handling, a stall is bridged by buffering instead of failing
+    network = !live && filename.find("://") != std::string::npos && filename.rfind("file:", 0) != 0;
+    if (network) {
+        avformat_network_init();
+        av_dict_set(&formatOptions, "reconnect", "1", 0);
+        av_dict_set(&formatOptions, "reconnect_streamed", "1", 0);
+        av_dict_set(&formatOptions, "reconnect_on_network_error", "1", 0);
+        av_dict_set(&formatOptions, "reconnect_delay_max", "10", 0);
+        av_dict_set(&formatOptions, "rw_timeout", "15000000", 0);
+        networkBuffer.low = config.bufferLow;
+        networkBuffer.high = std::max(config.bufferHigh, config.bufferLow);
+    }
+
+    // read local files through our own io backend when one is selected
+    mediaIO.reset(MediaIO::create(filename, config.ioBackend, config.readAheadWindow));
+    if (mediaIO) {
+        pFormatCtx->pb = mediaIO->context();
+        pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
     // open file
-    if (avformat_open_input(&pFormatCtx, filename.data(), nullptr, nullptr)) {
+    std::string url = filename == "-" ? "pipe:0" : filename;
+    int openRet = avformat_open_input(&pFormatCtx, url.c_str(), nullptr, &formatOptions);
+    av_dict_free(&formatOptions);
+    if (openRet) {
         throw std::runtime_error("Couldn't open file" + filename);
     }
 
-    if (avformat_find_stream_info(pFormatCtx, nullptr) < 0) {
-        avformat_close_input(&pFormatCtx);
-        throw std::runtime_error("Couldn't find stream info");
+    // a file seen before doesn't need to be probed again
+    if (config.probeCache && !live) {
+        probeCache = ProbeCache(filename);
+    }
+    if (probeCache.valid() && probeCache.load(probeEntry) && ProbeCache::apply(probeEntry, pFormatCtx)) {
+        std::cout << "stream info loaded from probe cache" << std::endl;
+    } else {
+        if (avformat_find_stream_info(pFormatCtx, nullptr) < 0) {
+            avformat_close_input(&pFormatCtx);
+            throw std::runtime_error("Couldn't find stream info");
+        }
+        if (probeCache.valid()) {
+            ProbeCache::capture(pFormatCtx, probeEntry);
+            probeCache.store(probeEntry);
+        }
     }
+    keyframeIndex.load(probeEntry.keyframes, probeEntry.keyframesComplete);
 
-    duration = pFormatCtx->duration / AV_TIME_BASE;
+    // streams without a known length show as 0 and can't be seeked by position
+    duration = live || pFormatCtx->duration == AV_NOPTS_VALUE ? 0.0 : static_cast<double>(pFormatCtx->duration / AV_TIME_BASE);
 
     // find video and audio stream
     videoIndex = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
@@ -49,6 +137,7 @@ FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& a
     hasVideo = videoIndex >= 0;
     hasAudio = audioIndex >= 0;
     if (!(hasVideo || hasAudio)) {
+        avformat_close_input(&pFormatCtx);
         throw std::runtime_error("Couldn't find video or audio stream");
     }
 
@@ -69,6 +158,11 @@ FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& a
         videoDecoder.pAVCtx->thread_count = 2;
         videoDecoder.pAVCtx->thread_type = FF_THREAD_FRAME;
         avcodec_parameters_to_context(videoDecoder.pAVCtx, pFormatCtx->streams[videoIndex]->codecpar);
+        // frame threading holds back a frame per thread, slices don't
+        if (live) {
+            videoDecoder.pAVCtx->thread_type = FF_THREAD_SLICE;
+            videoDecoder.pAVCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        }
 
         // Video Codec
         const AVCodec* pVideoCodec = avcodec_find_decoder(videoDecoder.pAVCtx->codec_id);
@@ -78,6 +172,21 @@ FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& a
             throw std::runtime_error("Couldn't find video decoder");
         }
 
+        // decode at a reduced resolution when even the largest output is much smaller than the video
+        width = videoDecoder.pAVCtx->width;
+        height = videoDecoder.pAVCtx->height;
+        if (config.maxOutputWidth > 0 && config.maxOutputHeight > 0) {
+            int lowres = 0;
+            while (lowres < pVideoCodec->max_lowres
+                && (width >> (lowres + 1)) >= config.maxOutputWidth && (height >> (lowres + 1)) >= config.maxOutputHeight) {
+                lowres++;
+            }
+            if (lowres > 0) {
+                videoDecoder.pAVCtx->lowres = lowres;
+                std::printf("decoding at 1/%d resolution\n", 1 << lowres);
+            }
+        }
+
         // open video codec
         if (avcodec_open2(videoDecoder.pAVCtx, pVideoCodec, nullptr) < 0) {
             avcodec_free_context(&videoDecoder.pAVCtx);
@@ -85,12 +194,14 @@ FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& a
             throw std::runtime_error("Couldn't open video decoder");
         }
 
-        width = videoDecoder.pAVCtx->width;
-        height = videoDecoder.pAVCtx->height;
-        pSwsCtx = sws_getContext(width, height, videoDecoder.pAVCtx->pix_fmt,
-            width, height, AV_PIX_FMT_RGBA,
-            SWS_BICUBIC, nullptr, nullptr, nullptr);
-
+        if (!videoIsCover && !network && !live && config.prefetchBudget > 0) {
+            prefetcher = std::make_unique<SeekPrefetcher>(filename, videoIndex, pFormatCtx->streams[videoIndex]->codecpar,
+                duration, keyframeIndex, config.prefetchBudget, [this] { return getRelativeTime(); });
+        }
+        if (!videoIsCover && !network && !live && config.gopCacheBudget > 0) {
+            gopCache = std::make_unique<GopCache>(filename, videoIndex, pFormatCtx->streams[videoIndex]->codecpar,
+                keyframeIndex, config.gopCacheBudget);
+        }
     }
 
     if (hasAudio) {
@@ -123,15 +234,220 @@ FFmpegDecoder::FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& a
         audioDst.sampleFormat = AUDIO_FORMAT_MAP[audio_spec.format];
         audioDst.freq = audio_spec.freq;
         av_channel_layout_default(&audioDst.channelLayout, audio_spec.channels);
+        audioClock.bytesPerPts = audioDst.channelLayout.nb_channels * av_get_bytes_per_sample(audioDst.sampleFormat)
+            * audioDst.freq * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
 
         if (swr_alloc_set_opts2(&pSwrCtx, &audioDst.channelLayout, audioDst.sampleFormat, audioDst.freq,
             &audioSrc.channelLayout, audioSrc.sampleFormat, audioSrc.freq, 0, nullptr
         )) {
+            avcodec_free_context(&audioDecoder.pAVCtx);
+            avformat_close_input(&pFormatCtx);
             throw std::runtime_error("Couldn't allocate swrContext");
         }
 
         swr_init(pSwrCtx);
     }
+
+    // badly interleaved files would block one stream's queue while the other starves; measured and
+    // decided by the demux thread before its first read, so opening isn't held up by it
+    if (hasVideo && hasAudio && !videoIsCover && !network && !live) {
+        demuxMode = config.demuxMode;
+        ioBackend = config.ioBackend;
+        readAheadWindow = config.readAheadWindow;
+    }
+
+    // the packet queues have to hold everything up to the high watermark, plus headroom
+    if (network) {
+        double seconds = networkBuffer.high * 1.5;
+        if (hasVideo && !videoIsCover) {
+            size_t packets = static_cast<size_t>(std::ceil(fps * seconds));
+            videoDecoder.packetQueue.set_max_size(std::max(videoDecoder.packetQueue.max_size(), packets));
+        }
+        if (hasAudio) {
+            AVCodecParameters* codecpar = pFormatCtx->streams[audioIndex]->codecpar;
+            int frameSize = codecpar->frame_size > 0 ? codecpar->frame_size : 1024;
+            size_t packets = static_cast<size_t>(std::ceil(codecpar->sample_rate * seconds / frameSize));
+            audioDecoder.packetQueue.set_max_size(std::max(audioDecoder.packetQueue.max_size(), packets));
+        }
+    }
+
+    // open at the requested position, playback starts from the keyframe before it
+    if (!live && config.startTime > 0.0 && config.startTime < duration) {
+        int64_t startTs = static_cast<int64_t>(config.startTime * AV_TIME_BASE);
+        if (int ret = avformat_seek_file(pFormatCtx, -1, INT64_MIN, startTs, startTs, 0); ret < 0) {
+            char error[64];
+            std::cout << "failed to seek to start time: " << av_make_error_string(error, sizeof(error), ret) << std::endl;
+        } else {
+            clock.audioTime = config.startTime;
+            clock.videoTime = config.startTime;
+        }
+    }
+
+    // replay loops the whole clip, captured on the first pass when it starts from the beginning
+    if (!live && config.loopCacheBudget > 0) {
+        loopCache = std::make_unique<LoopCache>(config.loopCacheBudget);
+    }
+    if (replay && !live) {
+        loop.begin = 0.0;
+        loop.end = std::numeric_limits<double>::infinity();
+        loop.active = true;
+        loop.capturing = loopCache && !audioFormatCtx && config.startTime <= 0.0;
+        if (loop.capturing) {
+            loopCache->expect(segmentBytes(duration));
+        }
+    }
+}
+
+size_t FFmpegDecoder::segmentBytes(double seconds) {
+    // what the loop cache keeps per second: decoder output at the decoded size, and the device PCM
+    double perSecond = 0.0;
+    if (videoIndex >= 0 && !videoIsCover) {
+        const AVCodecParameters* codecpar = pFormatCtx->streams[videoIndex]->codecpar;
+        int lowres = videoDecoder.pAVCtx ? videoDecoder.pAVCtx->lowres : 0;
+        int frameBytes = av_image_get_buffer_size(static_cast<AVPixelFormat>(codecpar->format),
+            codecpar->width >> lowres, codecpar->height >> lowres, 1);
+        perSecond += std::max(frameBytes, 0) * fps;
+    }
+    if (audioIndex >= 0) {
+        perSecond += static_cast<double>(audioDst.freq) * audioDst.channelLayout.nb_channels
+            * av_get_bytes_per_sample(audioDst.sampleFormat);
+    }
+    return static_cast<size_t>(perSecond * std::max(seconds, 0.0));
+}
+
+// everything is released by the demux thread as it exits, only what a throwing constructor left is freed here
+FFmpegDecoder::~FFmpegDecoder() = default;
+
+void FFmpegDecoder::decideDemuxing() {
+    if (demuxMode == DemuxMode::Single) {
+        return;
+    }
+    // skew the packet queues are grown to absorb, audio gets its own demuxer past it
+    static const double MAX_QUEUED_SKEW = 4.0;
+
+    bool split = demuxMode == DemuxMode::Split;
+    if (double skew; !split && measureInterleave(skew)) {
+        split = skew > MAX_QUEUED_SKEW;
+        if (!split) {
+            // both queues hold the skew and some headroom, whichever stream runs ahead
+            double seconds = skew + 1.0;
+            size_t videoPackets = static_cast<size_t>(std::ceil(std::max(fps, 1.0) * seconds));
+            videoDecoder.packetQueue.set_max_size(std::max(videoDecoder.packetQueue.max_size(), videoPackets));
+            if (probeEntry.audioPacketDuration > 0.0) {
+                size_t audioPackets = static_cast<size_t>(std::ceil(seconds / probeEntry.audioPacketDuration));
+                audioDecoder.packetQueue.set_max_size(std::max(audioDecoder.packetQueue.max_size(), audioPackets));
+            }
+        }
+    }
+    if (!split || !openAudioDemuxer()) {
+        return;
+    }
+    std::cout << "demuxing audio separately" << std::endl;
+    if (clock.audioTime > 0.0) {
+        int64_t startTs = static_cast<int64_t>(clock.audioTime * AV_TIME_BASE);
+        avformat_seek_file(audioFormatCtx, -1, INT64_MIN, startTs, startTs, 0);
+    }
+    // a separate audio demuxer runs ahead of the loop boundaries, such files loop by seeking
+    loop.capturing = false;
+}
+
+bool FFmpegDecoder::measureInterleave(double& skew) {
+    // measured when the file was first played, reading it again would delay every start
+    if (probeEntry.interleaveSkew < 0.0) {
+        if (!readInterleave(probeEntry.interleaveSkew, probeEntry.audioPacketDuration)) {
+            return false;
+        }
+        if (probeCache.valid()) {
+            probeCache.store(probeEntry);
+        }
+    }
+    skew = probeEntry.interleaveSkew;
+    return true;
+}
+
+bool FFmpegDecoder::readInterleave(double& skew, double& audioPacketDuration) {
+    // the file has to be read twice, don't do that to pipes
+    if (!pFormatCtx->pb || !(pFormatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        return false;
+    }
+
+    // how far apart in time the two streams are at the same file position, over the first seconds
+    static const double MEASURE_SECONDS = 10.0;
+    static const int MAX_PACKETS = 4000;
+    AVStream* videoStream = pFormatCtx->streams[videoIndex];
+    AVStream* audioStream = pFormatCtx->streams[audioIndex];
+    double videoTime = NAN, audioTime = NAN, firstTime = NAN;
+    double audioPacketSeconds = 0.0;
+    int audioPackets = 0;
+    skew = 0.0;
+
+    AVPacket* pAVpkt = packetPool.acquire();
+    for (int i = 0; i < MAX_PACKETS && av_read_frame(pFormatCtx, pAVpkt) >= 0; ++i) {
+        int64_t ts = pAVpkt->dts != AV_NOPTS_VALUE ? pAVpkt->dts : pAVpkt->pts;
+        if (ts != AV_NOPTS_VALUE && pAVpkt->stream_index == videoIndex) {
+            videoTime = ts * av_q2d(videoStream->time_base);
+        } else if (ts != AV_NOPTS_VALUE && pAVpkt->stream_index == audioIndex) {
+            audioTime = ts * av_q2d(audioStream->time_base);
+            audioPacketSeconds += pAVpkt->duration * av_q2d(audioStream->time_base);
+            audioPackets++;
+        }
+        av_packet_unref(pAVpkt);
+
+        if (!std::isnan(videoTime) && !std::isnan(audioTime)) {
+            skew = std::max(skew, std::abs(videoTime - audioTime));
+            if (std::isnan(firstTime)) {
+                firstTime = std::min(videoTime, audioTime);
+            } else if (std::max(videoTime, audioTime) - firstTime > MEASURE_SECONDS) {
+                break;
+            }
+        }
+    }
+    packetPool.release(pAVpkt);
+
+    // back to where the file was opened at
+    int64_t start = pFormatCtx->start_time != AV_NOPTS_VALUE ? pFormatCtx->start_time : 0;
+    if (clock.videoTime > 0.0) {
+        start = static_cast<int64_t>(clock.videoTime * AV_TIME_BASE);
+    }
+    avformat_seek_file(pFormatCtx, -1, INT64_MIN, start, start, 0);
+
+    // a stream that never showed up within the sample is as skewed as it gets
+    if (std::isnan(videoTime) != std::isnan(audioTime)) {
+        skew = MEASURE_SECONDS;
+    }
+    audioPacketDuration = audioPackets > 0 ? audioPacketSeconds / audioPackets : 0.0;
+    return true;
+}
+
+bool FFmpegDecoder::openAudioDemuxer() {
+    audioFormatCtx = avformat_alloc_context();
+    audioMediaIO.reset(MediaIO::create(filename, ioBackend, readAheadWindow));
+    if (audioMediaIO) {
+        audioFormatCtx->pb = audioMediaIO->context();
+        audioFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    bool opened = avformat_open_input(&audioFormatCtx, filename.data(), nullptr, nullptr) == 0;
+    // containers that only discover their streams while reading need probing here as well
+    if (opened && static_cast<int>(audioFormatCtx->nb_streams) <= audioIndex) {
+        opened = avformat_find_stream_info(audioFormatCtx, nullptr) >= 0;
+    }
+    if (opened && (static_cast<int>(audioFormatCtx->nb_streams) <= audioIndex
+        || audioFormatCtx->streams[audioIndex]->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)) {
+        opened = false;
+    }
+    if (!opened) {
+        avformat_close_input(&audioFormatCtx);
+        audioMediaIO.reset();
+        std::cout << "couldn't open a separate audio demuxer, reading all streams together" << std::endl;
+        return false;
+    }
+
+    for (unsigned i = 0; i < audioFormatCtx->nb_streams; ++i) {
+        audioFormatCtx->streams[i]->discard = (static_cast<int>(i) == audioIndex) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+    pFormatCtx->streams[audioIndex]->discard = AVDISCARD_ALL;
+    return true;
 }
 
 void FFmpegDecoder::run() {
@@ -151,6 +467,10 @@ bool FFmpegDecoder::isStopped() {
     return stopped;
 }
 
+bool FFmpegDecoder::isFinished() {
+    return finished || stopped;
+}
+
 std::shared_ptr<FFmpegDecoder::Frame> FFmpegDecoder::getVideoFrame() {
     std::shared_ptr<FFmpegDecoder::Frame> frame;
 
@@ -159,10 +479,111 @@ std::shared_ptr<FFmpegDecoder::Frame> FFmpegDecoder::getVideoFrame() {
     } else {
         videoDecoder.frameQueue.front(frame);
     }
+    if (frame->hasVideo()) {
+        shownVideoPts = frame->videoPts;
+    }
+    if (live && frame->hasVideo()) {
+        liveLatency.shownVideoTime = frame->videoPts * av_q2d(pFormatCtx->streams[videoIndex]->time_base);
+    }
 
     return  frame;
 }
 
+bool FFmpegDecoder::convertFrame(Frame& frame) {
+    if (!frame.source) {
+        return frame.data != nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutexSws);
+    if (swsReleased) {
+        return frame.data != nullptr;
+    }
+    AVFrame* source = frame.source;
+
+    // fit into the output size keeping the aspect ratio, never scale up
+    int dstWidth = source->width, dstHeight = source->height;
+    if (int maxWidth = outputWidth, maxHeight = outputHeight; maxWidth > 0 && maxHeight > 0
+        && (dstWidth > maxWidth || dstHeight > maxHeight)) {
+        double scale = std::min(static_cast<double>(maxWidth) / dstWidth, static_cast<double>(maxHeight) / dstHeight);
+        dstWidth = std::max(2, static_cast<int>(dstWidth * scale) & ~1);
+        dstHeight = std::max(2, static_cast<int>(dstHeight * scale) & ~1);
+    }
+
+    // a cached frame keeps its source, it is converted again only when the output size changed since
+    if (frame.data) {
+        if (frame.data->width == dstWidth && frame.data->height == dstHeight) {
+            return true;
+        }
+        av_freep(&frame.data->data[0]);
+        av_frame_free(&frame.data);
+    }
+
+    AVFrame* pAVframeRGB = av_frame_alloc();
+    pAVframeRGB->width = dstWidth;
+    pAVframeRGB->height = dstHeight;
+    pAVframeRGB->format = AV_PIX_FMT_RGBA;
+    // padded rows keep every line 64 byte aligned for the simd paths, the upload honours the stride
+    if (av_image_alloc(pAVframeRGB->data, pAVframeRGB->linesize, dstWidth, dstHeight, AV_PIX_FMT_RGBA, 64) < 0) {
+        av_frame_free(&pAVframeRGB);
+        throw std::runtime_error("Couldn't allocate pixel buffer for pAVframeRGB");
+    }
+
+    // without scaling the common formats don't need swscale's generic path
+    bool sameSize = dstWidth == source->width && dstHeight == source->height;
+    if (sameSize && ColorConvert::convert(source, pAVframeRGB->data[0], pAVframeRGB->linesize[0], AV_PIX_FMT_RGBA)) {
+        frame.data = pAVframeRGB;
+        if (!frame.keepSource) {
+            av_frame_free(&frame.source);
+        }
+        return true;
+    }
+
+    // rebuilt only when the source format or either size changes
+    pSwsCtx = sws_getCachedContext(pSwsCtx, source->width, source->height, static_cast<AVPixelFormat>(source->format),
+        dstWidth, dstHeight, AV_PIX_FMT_RGBA,
+        SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if (!pSwsCtx) {
+        av_freep(&pAVframeRGB->data[0]);
+        av_frame_free(&pAVframeRGB);
+        throw std::runtime_error("Couldn't create sws context");
+    }
+    // the matrix and range ColorConvert uses, so colours don't shift when the path toggles on a resize;
+    // swscale alone would take every frame as limited range 601
+    int* invTable;
+    int* table;
+    int srcRange, dstRange, brightness, contrast, saturation;
+    if (sws_getColorspaceDetails(pSwsCtx, &invTable, &srcRange, &table, &dstRange, &brightness, &contrast, &saturation) >= 0) {
+        int colorspace = source->colorspace;
+        if (colorspace == AVCOL_SPC_UNSPECIFIED) {
+            colorspace = source->height >= 720 ? SWS_CS_ITU709 : SWS_CS_ITU601;
+        }
+        // untagged yuvj formats keep the full range swscale already gave them
+        if (source->color_range != AVCOL_RANGE_UNSPECIFIED) {
+            srcRange = source->color_range == AVCOL_RANGE_JPEG ? 1 : 0;
+        }
+        sws_setColorspaceDetails(pSwsCtx, sws_getCoefficients(colorspace), srcRange, table, dstRange,
+            brightness, contrast, saturation);
+    }
+    if (!sws_scale(pSwsCtx, source->data, source->linesize, 0,
+        source->height, pAVframeRGB->data, pAVframeRGB->linesize)) {
+        av_freep(&pAVframeRGB->data[0]);
+        av_frame_free(&pAVframeRGB);
+        throw std::runtime_error("Convert to RGB32 error!");
+    }
+
+    // hand the codec's buffer back as early as possible
+    frame.data = pAVframeRGB;
+    if (!frame.keepSource) {
+        av_frame_free(&frame.source);
+    }
+    return true;
+}
+
+void FFmpegDecoder::setOutputSize(int width, int height) {
+    outputWidth = width;
+    outputHeight = height;
+}
+
 std::shared_ptr<FFmpegDecoder::Frame> FFmpegDecoder::getAudioFrame() {
     std::shared_ptr<FFmpegDecoder::Frame> frame;
 
@@ -191,6 +612,18 @@ double FFmpegDecoder::getDeltaTime() {
 }
 
 double FFmpegDecoder::getRelativeTime() {
+    // the audio clock stands still while stepping and during trick play, where the picture on
+    // screen is the position
+    if (stepping.mode != StepMode::Off) {
+        return clock.videoTime;
+    }
+    if (trick.rate != 1) {
+        return trick.shownKeyframe != AV_NOPTS_VALUE ? clock.videoTime : trick.anchorTime;
+    }
+    // while decoding towards a seek target the clocks still show frames before it
+    if (videoSeekTarget != AV_NOPTS_VALUE || audioSeekTarget != AV_NOPTS_VALUE) {
+        return seekStats.target;
+    }
     double curTime = 0.0;
     if (audioIndex >= 0) {
         curTime = clock.audioTime;
@@ -205,8 +638,17 @@ double FFmpegDecoder::getDuration() {
 }
 
 void FFmpegDecoder::seekTime(double time) {
-    seekReq = true;
-    seekReqTime = time;
+    if (live) {
+        return;
+    }
+    seekController.requestRelative(time);
+}
+
+void FFmpegDecoder::seekTo(double time) {
+    if (live) {
+        return;
+    }
+    seekController.requestAbsolute(time);
 }
 
 std::array<int, 2> FFmpegDecoder::getVideoSize() {
@@ -223,12 +665,12 @@ bool FFmpegDecoder::audioFrameReady() {
     return audioDecoder.frameQueue.size() > 0;
 }
 
-void FFmpegDecoder::updateAudioClock(int lens, int64_t newFrame) {
+void FFmpegDecoder::updateAudioClock(int lens, int64_t newFrame, double speed) {
     if (newFrame) {
         audioClock.pts = newFrame;
+        audioClock.speed = speed;
     } else {
-        static double temp = (audioDst.channelLayout.nb_channels *av_get_bytes_per_sample(audioDst.sampleFormat)) * audioDst.freq * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
-        audioClock.pts += (double) lens / temp;
+        audioClock.pts += static_cast<int64_t>(lens / audioClock.bytesPerPts * audioClock.speed);
     }
 }
 
@@ -237,120 +679,957 @@ int64_t FFmpegDecoder::getAudioTimePts() {
 }
 
 double FFmpegDecoder::getDelay(int64_t videoPts) {
-    return videoPts * av_q2d(pFormatCtx->streams[videoIndex]->time_base) - audioClock.pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+    double delay = videoPts * av_q2d(pFormatCtx->streams[videoIndex]->time_base) - audioClock.pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+    // around the wrap of a cached loop one of the clocks is back at the start of the segment already
+    if (double length = loop.length; loop.replaying && length > 0.0) {
+        if (delay < -length / 2) {
+            delay += length;
+        } else if (delay > length / 2) {
+            delay -= length;
+        }
+    }
+    return delay;
+}
+
+
+// a frame this late counts as behind, one earlier than the headroom counts as keeping up
+static const double LATE_THRESHOLD = 0.04;
+static const double HEADROOM_THRESHOLD = 0.01;
+// step down quickly, step back up only after a longer calm period to avoid oscillating
+static const double STEP_DOWN_AFTER = 1.0;
+static const double STEP_UP_AFTER = 5.0;
+
+void FFmpegDecoder::reportLateness(double lateness) {
+    // frames decoded towards a seek target, during trick play or stepping aren't representative
+    if (videoSeekTarget != AV_NOPTS_VALUE || trick.rate != 1 || stepping.mode != StepMode::Off) {
+        return;
+    }
+
+    bool late;
+    if (lateness > LATE_THRESHOLD) {
+        late = true;
+    } else if (lateness < -HEADROOM_THRESHOLD) {
+        late = false;
+    } else {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (late != loadShedding.late) {
+        loadShedding.late = late;
+        loadShedding.since = now;
+        return;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - loadShedding.since).count();
+    int level = loadShedding.level;
+    if (late && elapsed >= STEP_DOWN_AFTER && level < LoadShedding::MAX_LEVEL) {
+        level++;
+    } else if (!late && elapsed >= STEP_UP_AFTER && level > 0) {
+        level--;
+    } else {
+        return;
+    }
+    loadShedding.level = level;
+    loadShedding.since = now;
+
+    static const char* LEVEL_NAMES[] = {"full decode", "skip non-reference frames", "skip loop filter", "keyframes only"};
+    std::printf("decoder load shedding level %d: %s\n", level, LEVEL_NAMES[level]);
+}
+
+void FFmpegDecoder::applyLoadShedding(int level) {
+    videoDecoder.pAVCtx->skip_frame = level < 0 || level >= 3 ? AVDISCARD_NONKEY : level >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    videoDecoder.pAVCtx->skip_loop_filter = level >= 2 ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+}
+
+void FFmpegDecoder::buildKeyframeIndex() {
+    // the index is only worth building once the user actually seeks, and not over the network
+    if (videoIndex < 0 || videoIsCover || network) {
+        return;
+    }
+    keyframeIndex.build(filename, videoIndex, [this](const KeyframeIndex::Keyframes& keyframes) {
+        probeEntry.keyframeStream = videoIndex;
+        probeEntry.keyframesComplete = true;
+        probeEntry.keyframes = keyframes;
+        probeCache.store(probeEntry);
+    });
+}
+
+void FFmpegDecoder::flushDecoder(DecoderInfo& decoder, std::mutex& codecMutex) {
+    decoder.packetQueue.clear();
+    codecMutex.lock();
+    avcodec_flush_buffers(decoder.pAVCtx);
+    decoder.drained = false;
+    codecMutex.unlock();
+    decoder.frameQueue.clear();
 }
 
+void FFmpegDecoder::seekStream(double targetTime) {
+    bool seekVideo = videoIndex >= 0 && !videoIsCover;
+    buildKeyframeIndex();
+
+    seekStats.begin = std::chrono::steady_clock::now();
+    seekStats.target = targetTime;
+    seekSerial++;
+
+    // land on the last keyframe before the target, then decode forward to it
+    int ret = -1;
+    int64_t keyframePts;
+    if (seekVideo && keyframeIndex.findPrior(
+        static_cast<int64_t>(targetTime / av_q2d(pFormatCtx->streams[videoIndex]->time_base)), keyframePts)) {
+        ret = av_seek_frame(pFormatCtx, videoIndex, keyframePts, AVSEEK_FLAG_BACKWARD);
+    }
+    if (ret < 0) {
+        int64_t targetTs = static_cast<int64_t>(targetTime * AV_TIME_BASE);
+        ret = avformat_seek_file(pFormatCtx, -1, INT64_MIN, targetTs, targetTs, 0);
+        if (ret < 0) {
+            ret = avformat_seek_file(pFormatCtx, -1, INT64_MIN, targetTs, INT64_MAX, AVSEEK_FLAG_BACKWARD);
+        }
+    }
+    if (ret < 0) {
+        char error[64];
+        std::cout << "failed to seek time: " << av_make_error_string(error, sizeof(error), ret) << std::endl;
+        return;
+    }
+
+    if (seekVideo) {
+        flushDecoder(videoDecoder, mutexVideoCodec);
+        videoSeekTarget = static_cast<int64_t>(targetTime / av_q2d(pFormatCtx->streams[videoIndex]->time_base));
+
+        // show the prefetched keyframe while the decoder catches up to the target
+        if (prefetcher) {
+            if (std::shared_ptr<Frame> frame = prefetcher->lookup(targetTime)) {
+                videoDecoder.frameQueue.push(frame);
+                std::printf("seek prefetch hit at %.3lf s\n", targetTime);
+            }
+        }
+    }
+    if (audioIndex >= 0) {
+        flushDecoder(audioDecoder, mutexAudioCodec);
+        audioSeekTarget = static_cast<int64_t>(targetTime / av_q2d(pFormatCtx->streams[audioIndex]->time_base));
+    }
+    seekStats.pending = true;
+
+    // everything buffered is gone, refill before playing on
+    if (network) {
+        std::lock_guard<std::mutex> lock(networkBuffer.mutex);
+        networkBuffer.videoDemuxedTime = targetTime;
+        networkBuffer.audioDemuxedTime = targetTime;
+        networkBuffer.endOfInput = false;
+        networkBuffer.buffering = true;
+        networkBuffer.underrun = false;
+        networkBuffer.since = std::chrono::steady_clock::now();
+        networkBuffer.sinceBytes = networkBuffer.bytes;
+    }
+}
+
+bool FFmpegDecoder::isBuffering() {
+    if (!network) {
+        return false;
+    }
+    updateBuffering();
+    return networkBuffer.buffering;
+}
+
+double FFmpegDecoder::bufferedSeconds() {
+    double demuxed = std::numeric_limits<double>::max();
+    if (videoIndex >= 0 && !videoIsCover) {
+        demuxed = std::min<double>(demuxed, networkBuffer.videoDemuxedTime);
+    }
+    if (audioIndex >= 0) {
+        demuxed = std::min<double>(demuxed, networkBuffer.audioDemuxedTime);
+    }
+    return std::max(demuxed - getRelativeTime(), 0.0);
+}
+
+void FFmpegDecoder::updateBuffering() {
+    std::lock_guard<std::mutex> lock(networkBuffer.mutex);
+    double buffered = bufferedSeconds();
+    auto now = std::chrono::steady_clock::now();
+    // the queues are sized from estimated packet durations, short audio blocks or a wrong frame rate
+    // fill one early; the demuxer then blocks on it and the watermark would never be reached
+    bool queueFull = (videoIndex >= 0 && !videoIsCover && videoDecoder.packetQueue.full())
+        || (audioIndex >= 0 && audioDecoder.packetQueue.full());
+    if (!networkBuffer.buffering) {
+        if (buffered < networkBuffer.low && !networkBuffer.endOfInput && !queueFull) {
+            networkBuffer.buffering = true;
+            networkBuffer.underrun = true;
+            networkBuffer.since = now;
+            networkBuffer.sinceBytes = networkBuffer.bytes;
+            std::printf("buffering, %.1lf s left\n", buffered);
+        }
+        return;
+    }
+
+    // after running dry, fill up to the high watermark so it doesn't stutter right away again
+    double resumeAt = networkBuffer.underrun ? networkBuffer.high : networkBuffer.low;
+    if (buffered >= resumeAt || networkBuffer.endOfInput || queueFull) {
+        networkBuffer.buffering = false;
+        // health is only reported on the transitions, a steady stream stays quiet
+        double elapsed = std::chrono::duration<double>(now - networkBuffer.since).count();
+        std::printf("buffering done in %.1lf s, %.1lf s buffered (%zu video, %zu audio packets), %.0lf kB/s%s\n",
+            elapsed, buffered, videoDecoder.packetQueue.size(), audioDecoder.packetQueue.size(),
+            elapsed > 0.0 ? (networkBuffer.bytes - networkBuffer.sinceBytes) / 1024.0 / elapsed : 0.0,
+            queueFull && buffered < resumeAt ? ", packet queue full" : "");
+    }
+}
+
+void FFmpegDecoder::noteDemuxed(const AVPacket* pAVpkt, AVFormatContext* formatCtx) {
+    networkBuffer.bytes += static_cast<uint64_t>(pAVpkt->size);
+    int64_t ts = pAVpkt->dts != AV_NOPTS_VALUE ? pAVpkt->dts : pAVpkt->pts;
+    if (ts == AV_NOPTS_VALUE) {
+        return;
+    }
+    double time = ts * av_q2d(formatCtx->streams[pAVpkt->stream_index]->time_base);
+    if (pAVpkt->stream_index == videoIndex) {
+        networkBuffer.videoDemuxedTime = time;
+    } else if (pAVpkt->stream_index == audioIndex) {
+        networkBuffer.audioDemuxedTime = time;
+    }
+}
+
+void FFmpegDecoder::catchUp() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - liveLatency.lastCatchUp < std::chrono::milliseconds(500)) {
+        return;
+    }
+
+    // the output clock follows audio when there is any, otherwise the last frame handed to the draw thread
+    double demuxed, played;
+    if (audioIndex >= 0) {
+        if (audioClock.pts == 0) {
+            return;
+        }
+        demuxed = networkBuffer.audioDemuxedTime;
+        played = audioClock.pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+    } else {
+        if (liveLatency.shownVideoTime == 0.0) {
+            return;
+        }
+        demuxed = networkBuffer.videoDemuxedTime;
+        played = liveLatency.shownVideoTime;
+    }
+    double latency = demuxed - played;
+    if (latency <= liveLatency.max) {
+        return;
+    }
+    liveLatency.lastCatchUp = now;
+
+    // audio frames and packets decode independently, the audio clock jumps ahead and the draw
+    // thread skips the video frames that became late, video packets have to stay for the references
+    size_t droppedVideo = videoDecoder.frameQueue.trim(1).size();
+    size_t droppedAudio = audioDecoder.frameQueue.trim(1).size();
+    size_t droppedPackets = audioDecoder.packetQueue.trim(2).size();
+    std::printf("live latency %.0lf ms, dropped %zu video frames, %zu audio frames and %zu audio packets\n",
+        latency * 1000.0, droppedVideo, droppedAudio, droppedPackets);
+}
+
+double FFmpegDecoder::playbackTime() {
+    if (audioIndex >= 0) {
+        return audioClock.pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+    }
+    return clock.videoTime;
+}
+
+void FFmpegDecoder::setLoopStart() {
+    if (live) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    loop.markBegin = playbackTime();
+    std::printf("loop start at %.2lf s\n", loop.markBegin);
+}
+
+void FFmpegDecoder::setLoopEnd() {
+    if (live) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    double end = playbackTime();
+    if (loop.markBegin < 0.0 || end < loop.markBegin + 0.1) {
+        std::printf("set a loop start before the end\n");
+        return;
+    }
+    loop.requestBegin = loop.markBegin;
+    loop.requestEnd = end;
+    loop.requested = true;
+    loop.markBegin = -1.0;
+}
+
+void FFmpegDecoder::clearLoop() {
+    std::lock_guard<std::mutex> lock(loop.mutex);
+    loop.markBegin = -1.0;
+    loop.requestBegin = loop.requestEnd = 0.0;
+    loop.requested = true;
+}
+
+void FFmpegDecoder::applyLoopRequest() {
+    double begin, end;
+    {
+        std::lock_guard<std::mutex> lock(loop.mutex);
+        if (!loop.requested) {
+            return;
+        }
+        loop.requested = false;
+        begin = loop.requestBegin;
+        end = loop.requestEnd;
+    }
+    if (end > begin) {
+        startLoop(begin, end);
+    } else if (stopLoop()) {
+        // the demuxer stopped at the end of the first pass, carry on from where the replay is
+        seekStream(getRelativeTime());
+    }
+}
+
+void FFmpegDecoder::startLoop(double begin, double end) {
+    loop.active = false;
+    loop.capturing = false;
+    loop.replaying = false;
+    loop.begin = begin;
+    loop.end = end;
+    loop.length = end - begin;
+    loop.videoPastEnd = loop.audioPastEnd = false;
+    loop.passes = 0;
+    loop.active = true;
+    std::printf("loop %.2lf - %.2lf s\n", begin, end);
+
+    seekStream(begin);
+    // a separate audio demuxer runs ahead of the loop boundaries, such files loop by seeking
+    if (loopCache && !audioFormatCtx) {
+        loopCache->reset();
+        loopCache->expect(segmentBytes(end - begin));
+        loop.capturing = !loopCache->overBudget();
+    }
+}
+
+bool FFmpegDecoder::stopLoop() {
+    bool wasReplaying = loop.replaying;
+    loop.active = false;
+    loop.capturing = false;
+    loop.replaying = false;
+    if (loopCache) {
+        loopCache->reset();
+    }
+    std::printf("loop off\n");
+    return wasReplaying;
+}
+
+bool FFmpegDecoder::seekWithinLoop(double target) {
+    if (!loop.active) {
+        return false;
+    }
+    // leaving the segment ends the A-B repeat
+    if (target < loop.begin || target >= loop.end) {
+        stopLoop();
+        return false;
+    }
+    if (loop.replaying) {
+        videoDecoder.frameQueue.clear();
+        audioDecoder.frameQueue.clear();
+        loopCache->seek(target);
+        clock.videoTime = target;
+        clock.audioTime = target;
+        return true;
+    }
+    // the capture would have a gap, it is taken again on the next pass
+    if (loop.capturing) {
+        loop.capturing = false;
+        loopCache->restart();
+    }
+    return false;
+}
+
+bool FFmpegDecoder::pastLoopEnd(const AVPacket* pAVpkt) {
+    bool video = pAVpkt->stream_index == videoIndex;
+    bool& pastEnd = video ? loop.videoPastEnd : loop.audioPastEnd;
+    if (pastEnd) {
+        return true;
+    }
+    // decode order timestamps only grow, no frame before the end follows a packet past it
+    int64_t ts = pAVpkt->dts != AV_NOPTS_VALUE ? pAVpkt->dts : pAVpkt->pts;
+    if ((!video && pAVpkt->stream_index != audioIndex) || ts == AV_NOPTS_VALUE) {
+        return false;
+    }
+    pastEnd = ts * av_q2d(pFormatCtx->streams[pAVpkt->stream_index]->time_base) >= loop.end;
+    return pastEnd;
+}
+
+void FFmpegDecoder::finishLoopPass() {
+    // with a complete capture the next pass is queued right behind this one, so the frames held
+    // back in the decoders are collected without waiting for the output to play everything
+    bool cached = loop.capturing && loopCache->usable();
+    if (!drainDecoders(!cached)) {
+        return;
+    }
+    loop.capturing = false;
+    loop.videoPastEnd = loop.audioPastEnd = false;
+    loop.passes++;
+
+    if (cached && loopCache->usable()) {
+        loop.length = loopCache->span();
+        loop.replaying = true;
+        std::printf("loop cached: %zu frames, %.1lf MB, %.2lf s per pass\n",
+            loopCache->frameCount(), loopCache->bytes() / (1024.0 * 1024.0), loop.length.load());
+        return;
+    }
+
+    seekStream(loop.begin);
+    if (loopCache && !audioFormatCtx && !loopCache->overBudget()) {
+        loopCache->restart();
+        loop.capturing = true;
+    }
+}
+
+void FFmpegDecoder::replayLoopFrame() {
+    std::shared_ptr<Frame> frame;
+    double time;
+    bool video;
+    if (!loopCache->peek(frame, time, video)) {
+        loop.replaying = false;
+        return;
+    }
+
+    // back to the top of the read loop while the queue is full, for pauses, seeks and loop changes
+    DecoderInfo& decoder = video ? videoDecoder : audioDecoder;
+    if (decoder.frameQueue.full()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return;
+    }
+    if (video) {
+        clock.videoPts = frame->videoPts;
+        clock.videoTime = time;
+        // converted for display and released after it, the cache holds on to the decoder output only
+        auto shown = std::make_shared<Frame>();
+        shown->source = av_frame_clone(frame->source);
+        shown->videoPts = frame->videoPts;
+        frame = std::move(shown);
+    } else {
+        clock.audioPts = frame->audioPts;
+        clock.audioTime = time;
+    }
+    decoder.frameQueue.push(std::move(frame));
+    if (loopCache->advance()) {
+        loop.passes++;
+    }
+}
+
+void FFmpegDecoder::setTrickRate(int rate) {
+    if (live || videoIndex < 0 || videoIsCover) {
+        return;
+    }
+    if (rate == 0) {
+        rate = 1;
+    }
+    trick.requestedRate = std::clamp(rate, -TrickPlay::MAX_RATE, TrickPlay::MAX_RATE);
+}
+
+int FFmpegDecoder::getTrickRate() {
+    return trick.requestedRate;
+}
+
+bool FFmpegDecoder::isTrickPlay() {
+    return trick.rate != 1;
+}
+
+double FFmpegDecoder::trickPosition() {
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - trick.anchorWall).count();
+    double position = trick.anchorTime + trick.rate * elapsed;
+    return std::clamp(position, 0.0, duration > 0.0 ? duration : std::numeric_limits<double>::infinity());
+}
+
+void FFmpegDecoder::applyTrickRate() {
+    int requested = trick.requestedRate;
+    int rate = trick.rate;
+    if (requested == rate) {
+        return;
+    }
+    if (rate == 1) {
+        startTrickPlay(requested);
+    } else if (requested == 1) {
+        stopTrickPlay();
+    } else {
+        // carry on from the current position at the new rate, the keyframe in flight is kept
+        trick.anchorTime = trickPosition();
+        trick.anchorWall = std::chrono::steady_clock::now();
+        trick.rate = requested;
+        std::printf("trick play %dx\n", requested);
+    }
+}
+
+void FFmpegDecoder::startTrickPlay(int rate) {
+    if (loop.active) {
+        stopLoop();
+    }
+    double position = getRelativeTime();
+    stepping.mode = StepMode::Off;
+    buildKeyframeIndex();
+    videoSeekTarget = AV_NOPTS_VALUE;
+    audioSeekTarget = AV_NOPTS_VALUE;
+    seekStats.pending = false;
+
+    // audio isn't played, don't even demux it (a separate audio demuxer just idles on a full queue)
+    if (audioIndex >= 0 && !audioFormatCtx) {
+        trick.audioDiscard = pFormatCtx->streams[audioIndex]->discard;
+        pFormatCtx->streams[audioIndex]->discard = AVDISCARD_ALL;
+    }
+    trick.keyframes = 0;
+    trick.rate = rate;
+    anchorTrickPlay(position);
+    std::printf("trick play %dx from %.2lf s\n", rate, position);
+}
+
+void FFmpegDecoder::anchorTrickPlay(double time) {
+    seekSerial++;
+    seekStats.target = time;
+    flushDecoder(videoDecoder, mutexVideoCodec);
+    if (audioIndex >= 0) {
+        flushDecoder(audioDecoder, mutexAudioCodec);
+    }
+    // nothing in flight, the next step sends a keyframe right away
+    videoDecoder.drained = true;
+    trick.anchorTime = time;
+    trick.anchorWall = std::chrono::steady_clock::now();
+    trick.shownKeyframe = AV_NOPTS_VALUE;
+}
+
+void FFmpegDecoder::stopTrickPlay() {
+    // normal playback resumes at the picture on screen
+    double position = getRelativeTime();
+    if (audioIndex >= 0 && !audioFormatCtx) {
+        pFormatCtx->streams[audioIndex]->discard = trick.audioDiscard;
+    }
+    trick.rate = 1;
+    trick.requestedRate = 1;
+    std::printf("trick play off at %.2lf s, %llu keyframes decoded\n",
+        position, static_cast<unsigned long long>(trick.keyframes));
+    seekStream(position);
+}
+
+void FFmpegDecoder::trickPlayStep() {
+    // one keyframe at a time, the next one is chosen once the decoder has put out the last
+    if (!videoDecoder.drained) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return;
+    }
+
+    double position = trickPosition();
+    bool atBound = position <= 0.0 || (duration > 0.0 && position >= duration);
+    AVStream* stream = pFormatCtx->streams[videoIndex];
+    auto positionPts = static_cast<int64_t>(position / av_q2d(stream->time_base));
+
+    // a partial index can't tell whether a later keyframe exists, the demuxer is asked then
+    int64_t keyframePts;
+    bool indexed = keyframeIndex.complete() && keyframeIndex.findPrior(positionPts, keyframePts);
+    if (indexed && keyframePts == trick.shownKeyframe) {
+        if (atBound) {
+            stopTrickPlay();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return;
+    }
+
+    if (av_seek_frame(pFormatCtx, videoIndex, indexed ? keyframePts : positionPts, AVSEEK_FLAG_BACKWARD) < 0) {
+        stopTrickPlay();
+        return;
+    }
+    // the first video keyframe from there, everything else is skipped
+    static const int MAX_SCAN_PACKETS = 2000;
+    Packet packet(&packetPool, packetPool.acquire(), seekSerial);
+    AVPacket* pAVpkt = packet.data;
+    for (int i = 0; ; ++i) {
+        if (i == MAX_SCAN_PACKETS || av_read_frame(pFormatCtx, pAVpkt) < 0) {
+            packet.reset();
+            stopTrickPlay();
+            return;
+        }
+        if (pAVpkt->stream_index == videoIndex && (pAVpkt->flags & AV_PKT_FLAG_KEY)) {
+            break;
+        }
+        av_packet_unref(pAVpkt);
+    }
+
+    int64_t pts = pAVpkt->pts != AV_NOPTS_VALUE ? pAVpkt->pts : pAVpkt->dts;
+    if (pts == trick.shownKeyframe) {
+        packet.reset();
+        if (atBound) {
+            stopTrickPlay();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return;
+    }
+    trick.shownKeyframe = pts;
+    trick.keyframes++;
+
+    // the end of stream right behind it gets the picture out without waiting for more packets
+    videoDecoder.drained = false;
+    if (!pushPacket(videoDecoder, std::move(packet)) || !pushPacket(videoDecoder, Packet(&packetPool, nullptr, seekSerial))) {
+        videoDecoder.drained = true;
+    }
+}
+
+void FFmpegDecoder::stepFrame(int frames) {
+    if (gopCache == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stepping.mutex);
+    stepping.requestedSteps += frames;
+    // stepping holds the picture itself, the demux thread has to run for it
+    paused = false;
+}
+
+void FFmpegDecoder::toggleReverse() {
+    if (gopCache == nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(stepping.mutex);
+    stepping.requestReverse = !stepping.requestReverse;
+    paused = false;
+}
+
+void FFmpegDecoder::resumePlayback() {
+    std::lock_guard<std::mutex> lock(stepping.mutex);
+    stepping.requestResume = true;
+}
+
+bool FFmpegDecoder::isStepping() {
+    return stepping.mode != StepMode::Off;
+}
+
+void FFmpegDecoder::applyStepRequest() {
+    int steps;
+    bool reverse, resume;
+    {
+        std::lock_guard<std::mutex> lock(stepping.mutex);
+        steps = std::exchange(stepping.requestedSteps, 0);
+        reverse = std::exchange(stepping.requestReverse, false);
+        resume = std::exchange(stepping.requestResume, false);
+    }
+    if (resume) {
+        if (stepping.mode != StepMode::Off) {
+            stopStepping();
+        }
+        return;
+    }
+    if (steps == 0 && !reverse) {
+        return;
+    }
+    if (stepping.mode == StepMode::Off && !startStepping()) {
+        return;
+    }
+
+    if (reverse && stepping.mode != StepMode::Reverse) {
+        stepping.mode = StepMode::Reverse;
+        stepping.anchorTime = clock.videoTime;
+        stepping.anchorWall = std::chrono::steady_clock::now();
+        std::printf("reverse play from %.3lf s\n", stepping.anchorTime);
+    } else if (reverse) {
+        stepping.mode = StepMode::Still;
+        std::printf("reverse play off at %.3lf s\n", clock.videoTime);
+    }
+    // a step stops reverse play
+    if (steps != 0) {
+        stepping.mode = StepMode::Still;
+        stepping.steps += steps;
+    }
+}
+
+bool FFmpegDecoder::startStepping() {
+    if (gopCache == nullptr) {
+        return false;
+    }
+    if (trick.rate != 1) {
+        stopTrickPlay();
+    }
+    if (loop.active) {
+        stopLoop();
+    }
+    // from the picture on screen, the clocks run ahead of it by the queued frames
+    double timeBase = av_q2d(pFormatCtx->streams[videoIndex]->time_base);
+    int64_t pts = shownVideoPts;
+    double position = pts != AV_NOPTS_VALUE ? pts * timeBase : getRelativeTime();
+
+    buildKeyframeIndex();
+    gopCache->start();
+    seekSerial++;
+    videoSeekTarget = AV_NOPTS_VALUE;
+    audioSeekTarget = AV_NOPTS_VALUE;
+    seekStats.pending = false;
+    flushDecoder(videoDecoder, mutexVideoCodec);
+    if (audioIndex >= 0) {
+        flushDecoder(audioDecoder, mutexAudioCodec);
+    }
+
+    stepping.steps = 0;
+    stepping.mode = StepMode::Still;
+    anchorStepping(position);
+    std::printf("frame stepping at %.3lf s\n", position);
+    return true;
+}
+
+void FFmpegDecoder::anchorStepping(double time) {
+    stepping.targetPts = std::llround(time / av_q2d(pFormatCtx->streams[videoIndex]->time_base));
+    stepping.shownPts = AV_NOPTS_VALUE;
+    stepping.anchorTime = time;
+    stepping.anchorWall = std::chrono::steady_clock::now();
+    seekStats.target = time;
+    clock.videoTime = time;
+}
+
+void FFmpegDecoder::stopStepping() {
+    double position = clock.videoTime;
+    stepping.mode = StepMode::Off;
+    stepping.steps = 0;
+    std::printf("frame stepping off at %.3lf s\n", position);
+    seekStream(position);
+}
+
+void FFmpegDecoder::serveSteppedFrame() {
+    double timeBase = av_q2d(pFormatCtx->streams[videoIndex]->time_base);
+    std::shared_ptr<Frame> frame;
+    bool missing = false;
+    bool step = false;
+    int direction = 1;
+
+    if (stepping.mode == StepMode::Reverse) {
+        // paced by the wall clock, frames the cache can't deliver in time are skipped
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepping.anchorWall).count();
+        int64_t pts = std::llround((stepping.anchorTime - elapsed) / timeBase);
+        direction = -1;
+        gopCache->setPosition(pts, direction);
+        frame = gopCache->frameAt(pts, missing);
+        if (!frame && !missing) {
+            stepping.mode = StepMode::Still;
+            std::printf("reverse play reached the start\n");
+            return;
+        }
+        if (frame && frame->videoPts == stepping.shownPts) {
+            frame = nullptr;
+        }
+    } else if (stepping.shownPts == AV_NOPTS_VALUE) {
+        // a target before the first frame shows the first frame
+        frame = gopCache->frameAt(stepping.targetPts, missing);
+        if (!frame && !missing) {
+            frame = gopCache->next(stepping.targetPts, missing);
+        }
+    } else if (stepping.steps != 0) {
+        step = true;
+        direction = stepping.steps > 0 ? 1 : -1;
+        frame = direction > 0 ? gopCache->next(stepping.shownPts, missing) : gopCache->previous(stepping.shownPts, missing);
+        if (!frame && !missing) {
+            // the first or last frame of the file
+            stepping.steps = 0;
+            return;
+        }
+    }
+
+    if (!frame) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(missing ? 1 : 5));
+        return;
+    }
+    if (step) {
+        stepping.steps -= direction;
+    }
+    gopCache->setPosition(frame->videoPts, direction);
+    stepping.shownPts = frame->videoPts;
+    clock.videoPts = frame->videoPts;
+    clock.videoTime = frame->videoPts * timeBase;
+    videoDecoder.frameQueue.clear();
+    videoDecoder.frameQueue.push(std::move(frame));
+}
+
+void FFmpegDecoder::setSpeed(double speed) {
+    if (live) {
+        return;
+    }
+    this->speed = std::clamp(speed, MIN_SPEED, MAX_SPEED);
+}
+
+double FFmpegDecoder::getSpeed() {
+    return speed;
+}
+
+void FFmpegDecoder::applySpeed() {
+    double current = speed;
+    if (current == appliedSpeed) {
+        return;
+    }
+    appliedSpeed = current;
+    std::printf("speed %.2lfx\n", current);
+
+    // a cached loop pass holds PCM stretched for the old speed, the loop is decoded again
+    if (loop.replaying) {
+        double position = getRelativeTime();
+        loop.replaying = false;
+        loopCache->restart();
+        seekStream(position);
+    } else if (loop.capturing) {
+        loop.capturing = false;
+        loopCache->restart();
+    }
+}
+
+void FFmpegDecoder::reportSeek(double landedTime) {
+    if (!seekStats.pending.exchange(false)) {
+        return;
+    }
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - seekStats.begin).count();
+    double target = seekStats.target;
+    std::printf("seeked to %.3lf s, landed at %.3lf s (error %.1lf ms), latency %.1lf ms\n",
+        target, landedTime, (landedTime - target) * 1000.0, latency);
+}
 
 void FFmpegDecoder::readPacket() {
+    decideDemuxing();
     if (audioIndex >= 0) {
-        audioDecoder.decodeThread = std::thread(&FFmpegDecoder::audioDecode, this);
         audioDecoder.threadRunning = true;
+        audioDecoder.decodeThread = std::thread(&FFmpegDecoder::audioDecode, this);
         audioDecoder.decodeThread.detach();
     } else {
         audioDecoder.threadStopped = true;
     }
     if (videoIndex >= 0) {
-        videoDecoder.decodeThread = std::thread(&FFmpegDecoder::videoDecode, this);
         videoDecoder.threadRunning = true;
+        videoDecoder.decodeThread = std::thread(&FFmpegDecoder::videoDecode, this);
         videoDecoder.decodeThread.detach();
     } else {
         videoDecoder.threadStopped = true;
     }
+    if (prefetcher) {
+        prefetcher->start();
+    }
+    if (audioFormatCtx) {
+        audioReaderRunning = true;
+        audioReaderThread = std::thread(&FFmpegDecoder::readAudioPacket, this);
+    }
 
 
+    static const int MAX_READ_RETRIES = 10;
+    int readRetries = 0;
+    networkBuffer.since = std::chrono::steady_clock::now();
+    networkBuffer.sinceBytes = networkBuffer.bytes;
+
     while (running) {
         while (paused) {}
-        if (seekReq) {
-            double curTime = 0.0;
-            if (audioIndex >= 0) {
-                curTime = clock.audioTime;
-            } else {
-                curTime = clock.videoTime;
+        applyLoopRequest();
+        applyStepRequest();
+        applyTrickRate();
+        applySpeed();
+        if (double target; seekController.take(getRelativeTime(), target)) {
+            target = std::clamp(target, 0.0, std::max(duration - 0.5, 0.0));
+            if (stepping.mode != StepMode::Off) {
+                anchorStepping(target);
+            } else if (trick.rate != 1) {
+                anchorTrickPlay(target);
+            } else if (!seekWithinLoop(target)) {
+                seekStream(target);
             }
-            int64_t targetTs = (curTime + seekReqTime > duration) ?
-                (duration - 0.5) * AV_TIME_BASE : (curTime + seekReqTime) * AV_TIME_BASE;
+        }
+
+        if (trick.rate != 1) {
+            trickPlayStep();
+            continue;
+        }
+        if (stepping.mode != StepMode::Off) {
+            serveSteppedFrame();
+            continue;
+        }
+
+        // later passes of a cached loop need neither the demuxer nor the decoders
+        if (loop.replaying) {
+            replayLoopFrame();
+            continue;
+        }
 
-            if (int ret; (ret = avformat_seek_file(pFormatCtx, -1, INT64_MIN, targetTs, INT64_MAX, AVSEEK_FLAG_BACKWARD) < 0)) {
+        Packet packet(&packetPool, packetPool.acquire(), seekSerial);
+        AVPacket* pAVpkt = packet.data;
+        if (int ret = av_read_frame(pFormatCtx, pAVpkt); ret < 0) {
+            packet.reset();
+
+            // a connection ffmpeg couldn't restore itself, the buffer covers the retries
+            if (network && ret != AVERROR_EOF && readRetries < MAX_READ_RETRIES) {
+                readRetries++;
                 char error[64];
-                std::cout << "failed to seek time: " << av_make_error_string(error, sizeof(error), ret) << std::endl;
-            } else {
-                std::cout << "seeked " << seekReqTime << " s. " << std::endl;
-
-                if (videoIndex >= 0) {
-                    if (!videoIsCover) {
-                        videoDecoder.packetQueue.clear();
-                        mutexVideoCodec.lock();
-                        avcodec_flush_buffers(videoDecoder.pAVCtx);
-                        mutexVideoCodec.unlock();
-                        videoDecoder.frameQueue.clear();
-                    }
-                }
-                if (audioIndex >= 0) {
-                    audioDecoder.packetQueue.clear();
-                    mutexAudioCodec.lock();
-                    avcodec_flush_buffers(audioDecoder.pAVCtx);
-                    mutexAudioCodec.unlock();
-                    audioDecoder.frameQueue.clear();
-                }
+                std::printf("network read failed (%s), retry %d\n", av_make_error_string(error, sizeof(error), ret), readRetries);
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                continue;
             }
-            if (curTime + seekReqTime > duration) {
-                std::cout << "audioTime: " << duration << " s. " << std::endl;
-                std::cout << "videoTime: " << duration << " s. " << std::endl;
-                std::cout << std::endl;
-            } else {
-                std::cout << "audioTime: " << clock.audioTime + seekReqTime << " s. " << std::endl;
-                std::cout << "videoTime: " << clock.videoTime + seekReqTime << " s. " << std::endl;
-                std::cout << std::endl;
+            networkBuffer.endOfInput = true;
+
+            // the end of the file also ends a loop pass, for the whole clip or a segment up to the end
+            if (loop.active) {
+                finishLoopPass();
+                continue;
             }
-            seekReq = false;
-            seekReqTime = 0.0;
-        }
-
-        AVPacket* pAVpkt = av_packet_alloc();
-        if (av_read_frame(pFormatCtx, pAVpkt) < 0) {
-            if (replay) {
-                double curTime = 0.0;
-                if (audioIndex >= 0) {
-                    curTime = clock.audioTime;
-                } else {
-                    curTime = clock.videoTime;
-                }
-                seekTime(-curTime);
-                av_packet_unref(pAVpkt);
+
+            // let the decoders flush their delayed frames and the output play them
+            if (!drainDecoders()) {
+                // a seek arrived meanwhile, keep playing from there
+                continue;
+            }
+            if (replay && !live) {
+                seekTo(0.0);
                 std::cout << "Play again" << std::endl;
                 continue;
             }
             std::cout << "Playback finished" << std::endl;
-            av_packet_unref(pAVpkt);
+            finished = true;
             break;
         }
-        std::shared_ptr<Packet> packet = std::make_shared<Packet>();
-        packet->data = pAVpkt;
-        if (pAVpkt->stream_index == videoIndex) {
-            while (videoDecoder.packetQueue.full()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                if (!running) {
-                    break;
-                }
+        readRetries = 0;
+        if (network) {
+            noteDemuxed(pAVpkt, pFormatCtx);
+            updateBuffering();
+        } else if (live) {
+            noteDemuxed(pAVpkt, pFormatCtx);
+            catchUp();
+        }
+
+        // packets past the loop end aren't needed, once every stream is past it the pass is over
+        if (loop.active && pastLoopEnd(pAVpkt)) {
+            packet.reset();
+            if ((videoIndex < 0 || videoIsCover || loop.videoPastEnd) && (audioIndex < 0 || audioFormatCtx || loop.audioPastEnd)) {
+                finishLoopPass();
             }
-            videoDecoder.packetQueue.push(packet);
+            continue;
+        }
+
+        if (pAVpkt->stream_index == videoIndex) {
+            pushPacket(videoDecoder, std::move(packet));
         } else if (pAVpkt->stream_index == audioIndex) {
-            while (audioDecoder.packetQueue.full()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                if (!running) {
-                    break;
-                }
-            }
-            audioDecoder.packetQueue.push(packet);
+            pushPacket(audioDecoder, std::move(packet));
         }
     }
 
     videoDecoder.threadRunning = false;
     audioDecoder.threadRunning = false;
 
+    if (audioReaderThread.joinable()) {
+        audioReaderRunning = false;
+        audioReaderThread.join();
+    }
+
+    if (prefetcher) {
+        prefetcher->stop();
+        prefetcher.reset();
+    }
+    gopCache.reset();
+    keyframeIndex.stop();
+
     while (!videoDecoder.threadStopped || !audioDecoder.threadStopped) {}
+    loopCache.reset();
 
     avformat_close_input(&pFormatCtx);
+    if (mediaIO) {
+        mediaIO->printStats();
+        mediaIO.reset();
+    }
+    if (audioFormatCtx) {
+        avformat_close_input(&audioFormatCtx);
+        audioMediaIO.reset();
+    }
 
     audioDecoder.packetQueue.clear();
     videoDecoder.packetQueue.clear();
@@ -362,74 +1641,157 @@ void FFmpegDecoder::readPacket() {
     std::printf("FFmpegDecoder exiting...\n");
 }
 
-void FFmpegDecoder::videoDecode() {
-    AVFrame* pAVframe = av_frame_alloc();
-    while (videoDecoder.threadRunning) {
-        while (paused) {}
-        std::shared_ptr<Packet> pPacket;
-        while (!videoDecoder.packetQueue.size()) {
+bool FFmpegDecoder::pushPacket(DecoderInfo& decoder, Packet&& packet) {
+    // a newer seek request makes the packet worthless, don't wait for room in the queue
+    while (decoder.packetQueue.full() && running && decoder.threadRunning && !seekController.pending()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!running || !decoder.threadRunning || seekController.pending()) {
+        return false;
+    }
+    decoder.packetQueue.push(std::move(packet));
+    return true;
+}
+
+void FFmpegDecoder::readAudioPacket() {
+    int serial = seekSerial;
+    bool endOfStream = false;
+    while (audioReaderRunning) {
+        if (paused) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            if (videoDecoder.threadRunning) {
-                break;
+            continue;
+        }
+
+        // follow the seeks readPacket executes on the main demuxer
+        if (int current = seekSerial; current != serial) {
+            serial = current;
+            endOfStream = false;
+            int64_t targetTs = static_cast<int64_t>(seekStats.target * AV_TIME_BASE);
+            if (avformat_seek_file(audioFormatCtx, -1, INT64_MIN, targetTs, targetTs, 0) < 0) {
+                avformat_seek_file(audioFormatCtx, -1, INT64_MIN, targetTs, INT64_MAX, AVSEEK_FLAG_BACKWARD);
             }
         }
-        videoDecoder.packetQueue.pop(pPacket);
+        if (endOfStream) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
 
-        mutexVideoCodec.lock();
-        int ret = avcodec_send_packet(videoDecoder.pAVCtx, pPacket->data);
-        int gotFrame = avcodec_receive_frame(videoDecoder.pAVCtx, pAVframe);
-        mutexVideoCodec.unlock();
+        Packet packet(&packetPool, packetPool.acquire(), serial);
+        if (av_read_frame(audioFormatCtx, packet.data) < 0) {
+            endOfStream = true;
+            audioDecoder.drained = false;
+            pushPacket(audioDecoder, Packet(&packetPool, nullptr, serial));
+            continue;
+        }
+        if (packet.data->stream_index == audioIndex) {
+            pushPacket(audioDecoder, std::move(packet));
+        }
+    }
+}
 
+bool FFmpegDecoder::drainDecoders(bool untilPlayed) {
+    // the cover picture has been decoded long ago and its thread takes no more packets,
+    // a separate audio demuxer doesn't stop at the end of an A-B loop
+    bool drainVideo = videoIndex >= 0 && !videoIsCover;
+    bool drainAudio = audioIndex >= 0 && !(audioFormatCtx && loop.active && std::isfinite(loop.end.load()));
 
-        if (ret < 0) {
-            std::cout << "error during avcodec_send_packet" << std::endl;
+    if (drainVideo) {
+        videoDecoder.drained = false;
+        if (!pushPacket(videoDecoder, Packet(&packetPool, nullptr, seekSerial))) {
+            return false;
+        }
+    }
+    // with a separate audio demuxer the audio reader ends its own stream
+    if (drainAudio && !audioFormatCtx) {
+        audioDecoder.drained = false;
+        if (!pushPacket(audioDecoder, Packet(&packetPool, nullptr, seekSerial))) {
+            return false;
+        }
+    }
+
+    // the draw thread keeps the last video frame queued, audio frames are all consumed
+    auto finished = [this, drainVideo, drainAudio, untilPlayed] {
+        return (!drainVideo || (videoDecoder.drained && (!untilPlayed || videoDecoder.frameQueue.size() <= 1)))
+            && (!drainAudio || (audioDecoder.drained && (!untilPlayed || audioDecoder.frameQueue.size() == 0)));
+    };
+    while (!finished()) {
+        if (!running || seekController.pending()) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+void FFmpegDecoder::videoDecode() {
+    AVFrame* pAVframe = av_frame_alloc();
+    int appliedSheddingLevel = 0;
+    bool coverShown = false;
+    while (videoDecoder.threadRunning && !coverShown) {
+        while (paused) {}
+        Packet packet;
+        if (!waitPacket(videoDecoder, packet)) {
             continue;
         }
 
-        if (gotFrame == 0) {
-            // get time
-            if (pAVframe->pts == AV_NOPTS_VALUE) {
-                if (pPacket->data->pts == AV_NOPTS_VALUE) {
-                    // use frame rate
-                    static double lastTime = 0.0;
-                    clock.videoTime = lastTime + 1.0 * av_q2d(pFormatCtx->streams[videoIndex]->avg_frame_rate);
-                    lastTime = clock.videoTime;
-                } else {
-                    clock.videoPts = pAVframe->pkt_dts;
-                    clock.videoTime = (double) pAVframe->pkt_dts * av_q2d(pFormatCtx->streams[videoIndex]->time_base);
-                }
-            } else {
-                clock.videoPts = pAVframe->pts;
-                clock.videoTime = (double) pAVframe->pts * av_q2d(pFormatCtx->streams[videoIndex]->time_base);
-            }
+        // the packet will be flushed by a pending seek anyway
+        if (seekController.pending()) {
+            continue;
+        }
 
-            AVFrame* pAVframeRGB = av_frame_alloc();
-            pAVframeRGB->width = width;
-            pAVframeRGB->height = height;
-            pAVframeRGB->format = AV_PIX_FMT_RGBA;
-            if (!av_image_alloc(pAVframeRGB->data, pAVframeRGB->linesize, width, height, AV_PIX_FMT_RGB32, 1)) {
-                throw std::runtime_error("Couldn't allocate pixel buffer for pAVframeRGB");
+        // a packet with no data is the end of stream, sending it flushes the frames held back for reordering
+        AVPacket* pAVpkt = packet.data;
+        bool sent = false;
+        while (!sent && videoDecoder.threadRunning) {
+            mutexVideoCodec.lock();
+            if (packet.serial != seekSerial) {
+                mutexVideoCodec.unlock();
+                break;
+            }
+            // trick play only sends keyframes, they are decoded whatever the load; above 2x
+            // non-reference frames are skipped, the output couldn't show them all anyway (without
+            // audio the output paces by frame count, there it is left to the load shedding)
+            bool fast = speed > 2.0 && audioIndex >= 0;
+            int level = trick.rate != 1 ? -1 : std::max(loadShedding.level.load(), fast ? 1 : 0);
+            if (level != appliedSheddingLevel) {
+                applyLoadShedding(level);
+                appliedSheddingLevel = level;
+            }
+            int ret = avcodec_send_packet(videoDecoder.pAVCtx, pAVpkt);
+            mutexVideoCodec.unlock();
+
+            // EAGAIN: the decoder wants its output read first, the packet is sent again below
+            if (ret != AVERROR(EAGAIN)) {
+                sent = true;
+                if (ret < 0 && ret != AVERROR_EOF) {
+                    std::cout << "error during avcodec_send_packet" << std::endl;
+                    break;
+                }
             }
 
-            if (!sws_scale(pSwsCtx, pAVframe->data, pAVframe->linesize, 0,
-                height, pAVframeRGB->data, pAVframeRGB->linesize)) {
-                throw std::runtime_error("Convert to RGB32 error!");
+            // take every frame the decoder has ready, there can be none or several per packet
+            while (videoDecoder.threadRunning) {
+                mutexVideoCodec.lock();
+                if (packet.serial != seekSerial) {
+                    mutexVideoCodec.unlock();
+                    sent = true;
+                    break;
                 }
-            std::shared_ptr<Frame> frame = std::make_shared<Frame>();
-            frame->data = pAVframeRGB;
-            frame->videoPts = clock.videoPts;
-
-            // push to queue
-            while (videoDecoder.frameQueue.full()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                if (!videoDecoder.threadRunning) {
+                int gotFrame = avcodec_receive_frame(videoDecoder.pAVCtx, pAVframe);
+                if (gotFrame == AVERROR_EOF) {
+                    // fully drained, the codec accepts packets again only after a flush
+                    avcodec_flush_buffers(videoDecoder.pAVCtx);
+                    videoDecoder.drained = true;
+                }
+                mutexVideoCodec.unlock();
+                if (gotFrame < 0) {
                     break;
                 }
-            }
-            videoDecoder.frameQueue.push(frame);
 
-            if (videoIsCover) {
-                break;
+                if (queueVideoFrame(pAVframe, packet.serial) && videoIsCover) {
+                    coverShown = true;
+                    break;
+                }
             }
         }
     }
@@ -441,86 +1803,279 @@ void FFmpegDecoder::videoDecode() {
     }
 
     av_frame_free(&pAVframe);
+    mutexSws.lock();
     sws_freeContext(pSwsCtx);
+    pSwsCtx = nullptr;
+    swsReleased = true;
+    mutexSws.unlock();
     avcodec_flush_buffers(videoDecoder.pAVCtx);
     avcodec_free_context(&videoDecoder.pAVCtx);
 
     videoDecoder.threadStopped = true;
 }
 
+bool FFmpegDecoder::queueVideoFrame(AVFrame* pAVframe, int serial) {
+    // get time
+    double timeBase = av_q2d(pFormatCtx->streams[videoIndex]->time_base);
+    if (pAVframe->pts != AV_NOPTS_VALUE) {
+        clock.videoPts = pAVframe->pts;
+    } else if (pAVframe->pkt_dts != AV_NOPTS_VALUE) {
+        clock.videoPts = pAVframe->pkt_dts;
+    } else {
+        // use frame rate
+        clock.videoPts += static_cast<int64_t>(av_q2d(av_inv_q(pFormatCtx->streams[videoIndex]->avg_frame_rate)) / timeBase);
+    }
+    clock.videoTime = static_cast<double>(clock.videoPts) * timeBase;
+
+    // decoding towards a seek target, frames before it are dropped before any conversion
+    if (int64_t target = videoSeekTarget; target != AV_NOPTS_VALUE) {
+        if (clock.videoPts < target) {
+            av_frame_unref(pAVframe);
+            return false;
+        }
+        videoSeekTarget = AV_NOPTS_VALUE;
+        reportSeek(clock.videoTime);
+    }
+
+    // decoded past the end of a loop segment, the next pass starts over at its beginning
+    double time = clock.videoTime;
+    if (loop.active && time >= loop.end) {
+        av_frame_unref(pAVframe);
+        return false;
+    }
+    double frameDuration = pAVframe->duration > 0 ? pAVframe->duration * timeBase : 1.0 / fps;
+
+    // queued unconverted, frames the draw thread drops never pay for sws_scale
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    frame->source = av_frame_alloc();
+    av_frame_move_ref(frame->source, pAVframe);
+    frame->videoPts = clock.videoPts;
+    frame->immediate = trick.rate != 1;
+
+    // push to queue
+    while (videoDecoder.frameQueue.full()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!videoDecoder.threadRunning) {
+            return false;
+        }
+    }
+    if (serial != seekSerial) {
+        return false;
+    }
+    if (loop.capturing && !videoIsCover && time >= loop.begin) {
+        loopCache->add(frame, time, frameDuration, true);
+    }
+    videoDecoder.frameQueue.push(frame);
+    return true;
+}
+
 void FFmpegDecoder::audioDecode() {
     AVFrame* pAVframe = av_frame_alloc();
     while (audioDecoder.threadRunning) {
         while (paused) {}
-        std::shared_ptr<Packet> pPacket;
-        while (!audioDecoder.packetQueue.size()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            if (audioDecoder.threadRunning) {
-                break;
-            }
+        Packet packet;
+        if (!waitPacket(audioDecoder, packet)) {
+            continue;
         }
-        audioDecoder.packetQueue.pop(pPacket);
-
-        mutexAudioCodec.lock();
-        int ret = avcodec_send_packet(audioDecoder.pAVCtx, pPacket->data);
-        int gotFrame = avcodec_receive_frame(audioDecoder.pAVCtx, pAVframe);
-        mutexAudioCodec.unlock();
 
-        if (ret < 0) {
-            std::cout << "error during avcodec_send_packet" << std::endl;
+        if (seekController.pending()) {
             continue;
         }
 
-        if (gotFrame == 0) {
-            // get time
-            if (pAVframe->pts != AV_NOPTS_VALUE) {
-                clock.audioPts = pAVframe->pts;
-                clock.audioTime = (double) pAVframe->pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+        // same send/receive loop as videoDecode, audio packets often hold several frames
+        AVPacket* pAVpkt = packet.data;
+        bool sent = false;
+        while (!sent && audioDecoder.threadRunning) {
+            mutexAudioCodec.lock();
+            if (packet.serial != seekSerial) {
+                mutexAudioCodec.unlock();
+                break;
             }
+            int ret = avcodec_send_packet(audioDecoder.pAVCtx, pAVpkt);
+            mutexAudioCodec.unlock();
 
-            // Estimated sample size and buffer size
-            int outSamples = swr_get_out_samples(pSwrCtx, pAVframe->nb_samples);
-            int outBufferSize = av_samples_get_buffer_size(
-                nullptr, audioDst.channelLayout.nb_channels, outSamples,
-                audioDst.sampleFormat, 1
-                );
-
-            uint8_t* outBuffer = (uint8_t*)av_malloc(outBufferSize);
-
-            // Real sample size and buffer size
-            int convertedSamples = swr_convert(pSwrCtx,
-                &outBuffer, outSamples,
-                const_cast<const uint8_t **>(pAVframe->data), pAVframe->nb_samples
-                );
-            if (convertedSamples < 0) {
-                std::cout << "swr_convert error!" << std::endl;
-                continue;
+            if (ret != AVERROR(EAGAIN)) {
+                sent = true;
+                if (ret < 0 && ret != AVERROR_EOF) {
+                    std::cout << "error during avcodec_send_packet" << std::endl;
+                    break;
+                }
             }
-            outBufferSize = av_samples_get_buffer_size(
-                nullptr, audioDst.channelLayout.nb_channels, convertedSamples,
-                audioDst.sampleFormat, 1
-                );
-
-            std::shared_ptr<Frame> frame = std::make_shared<Frame>();
-            frame->audioData = outBuffer;
-            frame->audioBufferSize = outBufferSize;
-            frame->audioPts = clock.audioPts;
-
-            // push to queue
-            while (audioDecoder.frameQueue.full()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-                if (!audioDecoder.threadRunning) {
+
+            while (audioDecoder.threadRunning) {
+                mutexAudioCodec.lock();
+                if (packet.serial != seekSerial) {
+                    mutexAudioCodec.unlock();
+                    sent = true;
                     break;
                 }
+                int gotFrame = avcodec_receive_frame(audioDecoder.pAVCtx, pAVframe);
+                if (gotFrame == AVERROR_EOF) {
+                    avcodec_flush_buffers(audioDecoder.pAVCtx);
+                }
+                mutexAudioCodec.unlock();
+                if (gotFrame == AVERROR_EOF) {
+                    // the time stretch holds back its last window, queued before the end is reported
+                    drainAudioTempo(packet.serial);
+                    audioDecoder.drained = true;
+                }
+                if (gotFrame < 0) {
+                    break;
+                }
+
+                queueAudioFrame(pAVframe, packet.serial);
             }
-            audioDecoder.frameQueue.push(frame);
         }
     }
 
     av_frame_free(&pAVframe);
+    delete audioTempo;
+    audioTempo = nullptr;
     swr_free(&pSwrCtx);
     avcodec_flush_buffers(audioDecoder.pAVCtx);
     avcodec_free_context(&audioDecoder.pAVCtx);
 
     audioDecoder.threadStopped = true;
 }
+
+bool FFmpegDecoder::queueAudioFrame(AVFrame* pAVframe, int serial) {
+    // get time
+    if (pAVframe->pts != AV_NOPTS_VALUE) {
+        clock.audioPts = pAVframe->pts;
+        clock.audioTime = (double) pAVframe->pts * av_q2d(pFormatCtx->streams[audioIndex]->time_base);
+    }
+
+    // drop whole frames that end before the seek target
+    if (int64_t target = audioSeekTarget; target != AV_NOPTS_VALUE) {
+        if (pAVframe->pts != AV_NOPTS_VALUE && pAVframe->pts + pAVframe->duration < target) {
+            av_frame_unref(pAVframe);
+            return false;
+        }
+        audioSeekTarget = AV_NOPTS_VALUE;
+        if (videoIndex < 0 || videoIsCover) {
+            reportSeek(clock.audioTime);
+        }
+    }
+
+    double time = clock.audioTime;
+    if (loop.active && time >= loop.end) {
+        av_frame_unref(pAVframe);
+        return false;
+    }
+
+    // Estimated sample size and buffer size
+    int outSamples = swr_get_out_samples(pSwrCtx, pAVframe->nb_samples);
+    int outBufferSize = av_samples_get_buffer_size(
+        nullptr, audioDst.channelLayout.nb_channels, outSamples,
+        audioDst.sampleFormat, 1
+        );
+
+    uint8_t* outBuffer = (uint8_t*)av_malloc(outBufferSize);
+
+    // Real sample size and buffer size
+    int convertedSamples = swr_convert(pSwrCtx,
+        &outBuffer, outSamples,
+        const_cast<const uint8_t **>(pAVframe->data), pAVframe->nb_samples
+        );
+    av_frame_unref(pAVframe);
+    if (convertedSamples < 0) {
+        std::cout << "swr_convert error!" << std::endl;
+        av_freep(&outBuffer);
+        return false;
+    }
+    outBufferSize = av_samples_get_buffer_size(
+        nullptr, audioDst.channelLayout.nb_channels, convertedSamples,
+        audioDst.sampleFormat, 1
+        );
+
+    // a speed change plays out what the filter holds at the old speed, after a seek it is dropped
+    double frameSpeed = speed;
+    if (audioTempo && (audioTempo->speed() != frameSpeed || tempoSerial != serial)) {
+        if (tempoSerial == serial) {
+            drainAudioTempo(serial);
+        }
+        delete audioTempo;
+        audioTempo = nullptr;
+    }
+    if (frameSpeed == 1.0) {
+        return pushAudioFrame(outBuffer, outBufferSize, convertedSamples, clock.audioPts, time, 1.0, serial);
+    }
+
+    // time-stretched, the filter starts over after a seek so nothing from before it comes out
+    if (audioTempo == nullptr) {
+        audioTempo = new AudioTempo(audioDst.freq, audioDst.channelLayout, audioDst.sampleFormat, frameSpeed);
+        tempoSerial = serial;
+        if (!audioTempo->valid()) {
+            std::printf("atempo filter unavailable, speed %.2lfx not supported\n", frameSpeed);
+            delete audioTempo;
+            audioTempo = nullptr;
+            speed = 1.0;
+            return pushAudioFrame(outBuffer, outBufferSize, convertedSamples, clock.audioPts, time, 1.0, serial);
+        }
+    }
+    std::vector<AudioTempo::Chunk> chunks;
+    bool ok = audioTempo->process(outBuffer, convertedSamples, std::llround(time * audioDst.freq), chunks);
+    av_freep(&outBuffer);
+    return pushTempoChunks(chunks, ok, frameSpeed, serial);
+}
+
+bool FFmpegDecoder::drainAudioTempo(int serial) {
+    if (audioTempo == nullptr) {
+        return true;
+    }
+    std::vector<AudioTempo::Chunk> chunks;
+    bool ok = audioTempo->flush(chunks);
+    double frameSpeed = audioTempo->speed();
+    delete audioTempo;
+    audioTempo = nullptr;
+    return pushTempoChunks(chunks, ok, frameSpeed, serial);
+}
+
+bool FFmpegDecoder::pushTempoChunks(std::vector<AudioTempo::Chunk>& chunks, bool ok, double frameSpeed, int serial) {
+    // chunk positions are in samples of the media, back to the stream's time base
+    double ptsPerSample = 1.0 / (audioDst.freq * av_q2d(pFormatCtx->streams[audioIndex]->time_base));
+    for (AudioTempo::Chunk& chunk : chunks) {
+        if (ok) {
+            ok = pushAudioFrame(chunk.data, chunk.size, chunk.samples, std::llround(chunk.pts * ptsPerSample),
+                static_cast<double>(chunk.pts) / audioDst.freq, frameSpeed, serial);
+        } else {
+            av_freep(&chunk.data);
+        }
+    }
+    return ok;
+}
+
+bool FFmpegDecoder::pushAudioFrame(uint8_t* data, int size, int samples, int64_t pts, double time, double frameSpeed, int serial) {
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    frame->audioData = data;
+    frame->audioBufferSize = size;
+    frame->audioPts = pts;
+    frame->audioSpeed = frameSpeed;
+
+    // push to queue
+    while (audioDecoder.frameQueue.full()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!audioDecoder.threadRunning) {
+            return false;
+        }
+    }
+    if (serial != seekSerial) {
+        return false;
+    }
+    if (loop.capturing && time >= loop.begin) {
+        loopCache->add(frame, time, samples * frameSpeed / audioDst.freq, false);
+    }
+    audioDecoder.frameQueue.push(frame);
+    return true;
+}
+
+bool FFmpegDecoder::waitPacket(DecoderInfo& decoder, Packet& packet) {
+    while (!decoder.packetQueue.size()) {
+        if (!decoder.threadRunning) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    decoder.packetQueue.pop(packet);
+    return true;
+}
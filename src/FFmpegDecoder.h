@@ -16,15 +16,90 @@ extern "C"
 #include <libswresample/swresample.h>
 }
 #include <thread>
+#include <chrono>
 #include <string>
 #include <atomic>
+#include <memory>
+#include <utility>
 #include <condition_variable>
 #include <SDL2/SDL_audio.h>
 #include "ThreadSafeQueue.h"
+#include "PacketPool.h"
+#include "MediaIO.h"
+#include "ProbeCache.h"
+#include "KeyframeIndex.h"
+#include "SeekController.h"
+#include "AudioTempo.h"
+
+// Auto grows the packet queues to absorb the file's interleaving, and demuxes audio on its own past a few seconds
+enum class DemuxMode {
+    Auto,
+    Single,
+    Split
+};
+
+struct DecoderConfig {
+    bool replay = false;
+
+    // position to open at, in seconds
+    double startTime = 0.0;
+
+    // avformat probesize (bytes) and analyzeduration (microseconds), 0 keeps the ffmpeg defaults
+    int64_t probeSize = 0;
+    int64_t analyzeDuration = 0;
+
+    // reuse stream parameters of files opened before instead of probing them again
+    bool probeCache = true;
+
+    // memory for keyframes decoded ahead around the current position, in bytes, 0 disables it
+    size_t prefetchBudget = 0;
+
+    // largest size the video can be displayed at, used to pick a reduced decode resolution
+    // for codecs that support lowres, 0 decodes at full size
+    int maxOutputWidth = 0;
+    int maxOutputHeight = 0;
+
+    // how local files are read, Default leaves it to ffmpeg's file protocol
+    MediaIO::Backend ioBackend = MediaIO::Backend::Default;
+    // bytes kept in memory ahead of the demuxer by the read-ahead backend
+    size_t readAheadWindow = 32 * 1024 * 1024;
+
+    DemuxMode demuxMode = DemuxMode::Auto;
+
+    // network input, in seconds of media: playback pauses to rebuffer below the low watermark
+    // and resumes at the high one (startup and seeks resume at the low one already)
+    double bufferLow = 2.0;
+    double bufferHigh = 8.0;
+
+    // low latency input with seeking disabled, always on for stdin, pipes, fifos and udp/rtp/srt
+    bool live = false;
+    // live input: once more than this many seconds are queued ahead of the output, the oldest
+    // queued frames are dropped to get back to real time
+    double maxLatency = 0.1;
+
+    // memory for the decoded frames of a loop segment (A-B repeat, or the whole clip with replay),
+    // later passes are played from it without decoding, 0 always loops by seeking; at most half
+    // the physical memory is used
+    size_t loopCacheBudget = static_cast<size_t>(2048) * 1024 * 1024;
+
+    // memory for the decoded GOPs frame stepping and reverse play are served from, 0 disables both
+    size_t gopCacheBudget = 512 * 1024 * 1024;
+
+    // playback speed from 0.25 to 4, the audio is time-stretched with its pitch kept
+    double speed = 1.0;
+};
+
+class SeekPrefetcher;
+class LoopCache;
+class GopCache;
 
 class FFmpegDecoder {
 public:
-    explicit FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& audio_spec, bool replay);
+    // whether the input can only be read as it arrives, "-" is stdin
+    static bool isLiveSource(const std::string& filename);
+
+    explicit FFmpegDecoder(const std::string& filename, const SDL_AudioSpec& audio_spec, const DecoderConfig& config);
+    ~FFmpegDecoder();
 
     void run();
 
@@ -34,6 +109,10 @@ public:
 
     bool isStopped();
 
+    // everything up to the end has been played, or the decoder was stopped,
+    // the threads may still be tearing down until isStopped
+    bool isFinished();
+
     struct Frame {
         ~Frame() {
             this->free();
@@ -44,19 +123,73 @@ public:
                 av_freep(&data->data[0]);
                 av_frame_free(&data);
             }
+            av_frame_free(&source);
+            av_freep(&audioData);
+        }
+
+        bool hasVideo() const {
+            return data || source;
         }
 
+        // RGBA, filled by convertFrame only for frames that are presented
         AVFrame* data = nullptr;
+        // decoder output as is, a reference to the codec's buffer
+        AVFrame* source = nullptr;
+        // converted PCM, owned by the frame, the audio player keeps the frame while it plays it
         uint8_t* audioData = nullptr;
         int audioBufferSize = 0;
+        // media seconds per second of the PCM, the speed it was stretched for
+        double audioSpeed = 1.0;
         int64_t videoPts = 0;
         int64_t audioPts = 0;
+
+        // shown as soon as it arrives, without waiting for the clock
+        bool immediate = false;
+        // cached frames are shown again, maybe at another output size, their source is kept to convert anew
+        bool keepSource = false;
     };
 
     std::shared_ptr<Frame> getVideoFrame();
 
     std::shared_ptr<Frame> getAudioFrame();
 
+    // converts frame->source to RGBA into frame->data, a no-op for frames already converted to the
+    // current output size
+    bool convertFrame(Frame& frame);
+
+    // size the video is displayed at, frames are scaled down to fit it when converted,
+    // 0 keeps the decoded size
+    void setOutputSize(int width, int height);
+
+    // A-B repeat: marks the start at the current position, the end mark starts looping
+    // from the start, clearLoop goes back to normal playback
+    void setLoopStart();
+    void setLoopEnd();
+    void clearLoop();
+
+    // trick play at rate times normal speed, negative rates rewind, 1 is normal playback;
+    // only keyframes are decoded and the audio is muted meanwhile
+    void setTrickRate(int rate);
+    int getTrickRate();
+    bool isTrickPlay();
+
+    // frame stepping holds the picture and moves it by frames, negative steps go back; reverse
+    // play runs backwards at normal speed; audio is muted for both until resumePlayback
+    void stepFrame(int frames);
+    void toggleReverse();
+    void resumePlayback();
+    bool isStepping();
+
+    // playback speed, clamped to 0.25 - 4; the audio clock runs at this rate and the video
+    // follows it, dropping or holding frames
+    static constexpr double MIN_SPEED = 0.25;
+    static constexpr double MAX_SPEED = 4.0;
+    void setSpeed(double speed);
+    double getSpeed();
+
+    // true while a network stream refills its buffer, the output should hold still meanwhile
+    bool isBuffering();
+
     bool isVideo();
 
     bool hasAudio();
@@ -69,8 +202,11 @@ public:
 
     double getDuration();
 
+    // relative seek, requests issued before the seek executes are merged
     void seekTime(double time);
 
+    void seekTo(double time);
+
     std::array<int, 2> getVideoSize();
 
     // about sdl2 audio
@@ -82,18 +218,167 @@ public:
     struct AudioClock {
         std::atomic<int64_t> pts = 0;
         int sample_rate = 1;
+        // output bytes per tick of the audio stream's time base
+        double bytesPerPts = 1.0;
+        // of the frame playing, each output byte covers this many bytes of media
+        double speed = 1.0;
     };
     AudioClock audioClock;
-    void updateAudioClock(int lens, int64_t newFrame);
+    void updateAudioClock(int lens, int64_t newFrame, double speed = 1.0);
 
     int64_t getAudioTimePts();
     double getDelay(int64_t videoPts);
+
+    // feedback from the presenter, seconds a frame is behind its due time (negative when early),
+    // sustained lateness makes the video decoder skip work until there is headroom again
+    void reportLateness(double lateness);
 private:
     std::string filename;
     double duration;
     double fps;
     bool replay;
     AVFormatContext* pFormatCtx;
+    // owned here so a constructor that throws doesn't leak them, the demux thread releases them in order
+    std::unique_ptr<MediaIO> mediaIO;
+
+    // network input buffering, demuxed times are the newest packet timestamps read per stream
+    bool network = false;
+    struct NetworkBuffer {
+        std::mutex mutex;
+        double low = 0.0;
+        double high = 0.0;
+        bool buffering = true;
+        bool underrun = false;
+        std::chrono::steady_clock::time_point since;
+        std::atomic<double> videoDemuxedTime = 0.0;
+        std::atomic<double> audioDemuxedTime = 0.0;
+        std::atomic<bool> endOfInput = false;
+        std::atomic<uint64_t> bytes = 0;
+        uint64_t sinceBytes = 0;
+    };
+    NetworkBuffer networkBuffer;
+    double bufferedSeconds();
+    void updateBuffering();
+    void noteDemuxed(const AVPacket* pAVpkt, AVFormatContext* formatCtx);
+
+    // live input, latency is the newest demuxed time ahead of what is being played
+    bool live = false;
+    struct LiveLatency {
+        double max = 0.0;
+        std::atomic<double> shownVideoTime = 0.0;
+        std::chrono::steady_clock::time_point lastCatchUp;
+    };
+    LiveLatency liveLatency;
+    void catchUp();
+
+    // loop segment, end is infinite for the whole clip; the first pass is decoded and captured,
+    // later ones replay the cache, or seek back to begin when it didn't fit
+    std::unique_ptr<LoopCache> loopCache;
+    struct Loop {
+        std::atomic<bool> active = false;
+        std::atomic<bool> capturing = false;
+        std::atomic<bool> replaying = false;
+        std::atomic<double> begin = 0.0;
+        std::atomic<double> end = 0.0;
+        // one pass in seconds, the clocks are compared modulo this across the wrap
+        std::atomic<double> length = 0.0;
+        bool videoPastEnd = false;
+        bool audioPastEnd = false;
+        int passes = 0;
+
+        // marks from the keys, applied by the demux thread
+        std::mutex mutex;
+        double markBegin = -1.0;
+        bool requested = false;
+        double requestBegin = 0.0;
+        double requestEnd = 0.0;
+    };
+    Loop loop;
+    double playbackTime();
+    void applyLoopRequest();
+    void startLoop(double begin, double end);
+    // decoded bytes the loop cache needs for seconds of media
+    size_t segmentBytes(double seconds);
+    bool stopLoop();
+    bool seekWithinLoop(double target);
+    bool pastLoopEnd(const AVPacket* pAVpkt);
+    void finishLoopPass();
+    void replayLoopFrame();
+
+    // trick play: the position follows anchorTime + rate * wall time since anchorWall, a keyframe
+    // is decoded whenever the position moves into another keyframe's interval, so the decoding
+    // cost depends on the keyframes shown and not on the rate
+    struct TrickPlay {
+        static constexpr int MAX_RATE = 64;
+        std::atomic<int> requestedRate = 1;
+        std::atomic<int> rate = 1;
+        double anchorTime = 0.0;
+        std::chrono::steady_clock::time_point anchorWall;
+        int64_t shownKeyframe = AV_NOPTS_VALUE;
+        AVDiscard audioDiscard = AVDISCARD_DEFAULT;
+        uint64_t keyframes = 0;
+    };
+    TrickPlay trick;
+    double trickPosition();
+    void applyTrickRate();
+    void startTrickPlay(int rate);
+    void anchorTrickPlay(double time);
+    void stopTrickPlay();
+    void trickPlayStep();
+
+    // stepping and reverse play, the demux thread serves frames from the GOP cache meanwhile and
+    // neither reads the main demuxer nor feeds the decoders
+    std::unique_ptr<GopCache> gopCache;
+    enum class StepMode {
+        Off,
+        Still,
+        Reverse
+    };
+    struct Stepping {
+        std::atomic<StepMode> mode = StepMode::Off;
+        // the picture on screen, AV_NOPTS_VALUE until the one at targetPts has been queued
+        int64_t shownPts = AV_NOPTS_VALUE;
+        int64_t targetPts = 0;
+        int steps = 0;
+        double anchorTime = 0.0;
+        std::chrono::steady_clock::time_point anchorWall;
+
+        // from the keys, applied by the demux thread
+        std::mutex mutex;
+        int requestedSteps = 0;
+        bool requestReverse = false;
+        bool requestResume = false;
+    };
+    Stepping stepping;
+    // requested speed, the audio decode thread stretches the PCM for it
+    std::atomic<double> speed = 1.0;
+    double appliedSpeed = 1.0;
+    AudioTempo* audioTempo = nullptr;
+    int tempoSerial = 0;
+    void applySpeed();
+    bool drainAudioTempo(int serial);
+    bool pushTempoChunks(std::vector<AudioTempo::Chunk>& chunks, bool ok, double frameSpeed, int serial);
+
+    // newest video frame handed to the output
+    std::atomic<int64_t> shownVideoPts = AV_NOPTS_VALUE;
+    void applyStepRequest();
+    bool startStepping();
+    void anchorStepping(double time);
+    void stopStepping();
+    void serveSteppedFrame();
+
+    // split demuxing: audio packets come from a second demuxer with its own read position,
+    // following the seeks done on pFormatCtx through seekSerial
+    AVFormatContext* audioFormatCtx = nullptr;
+    std::unique_ptr<MediaIO> audioMediaIO;
+    std::thread audioReaderThread;
+    std::atomic<bool> audioReaderRunning = false;
+    // Single once there is nothing to decide, the other two are settled by decideDemuxing
+    DemuxMode demuxMode = DemuxMode::Single;
+    MediaIO::Backend ioBackend = MediaIO::Backend::Default;
+    size_t readAheadWindow = 0;
+    ProbeCache probeCache;
+    ProbeCache::Entry probeEntry;
     int videoIndex = -1, audioIndex = -1;
     bool videoIsCover = false;
 
@@ -103,6 +388,7 @@ private:
     std::atomic<bool> paused = false;
 
     std::atomic<bool> stopped = false;
+    std::atomic<bool> finished = false;
 
     // clock for seek
     struct Clock {
@@ -115,19 +401,74 @@ private:
     Clock clock;
 
     // seek
-    std::atomic<bool> seekReq = false;
-    double seekReqTime = 0.0;
+    SeekController seekController;
+    // bumped on every executed seek, packets and frames of an older serial are dropped
+    std::atomic<int> seekSerial = 0;
     std::mutex mutexVideoCodec;
     std::mutex mutexAudioCodec;
 
-    // decoder
+    // frame-accurate seek: decoded frames before the target are dropped unconverted,
+    // targets are in the stream's time base, AV_NOPTS_VALUE when no seek is in progress
+    KeyframeIndex keyframeIndex;
+    std::atomic<int64_t> videoSeekTarget = AV_NOPTS_VALUE;
+    std::atomic<int64_t> audioSeekTarget = AV_NOPTS_VALUE;
+    struct SeekStats {
+        std::chrono::steady_clock::time_point begin;
+        std::atomic<double> target = 0.0;
+        std::atomic<bool> pending = false;
+    };
+    SeekStats seekStats;
+    std::unique_ptr<SeekPrefetcher> prefetcher;
+
+    // load shedding levels: 0 full decode, 1 skip non-reference frames,
+    // 2 also skip the loop filter, 3 keyframes only, -1 is trick play (keyframes, full quality)
+    struct LoadShedding {
+        static constexpr int MAX_LEVEL = 3;
+        std::atomic<int> level = 0;
+        bool late = false;
+        std::chrono::steady_clock::time_point since;
+    };
+    LoadShedding loadShedding;
+    void applyLoadShedding(int level);
+    void buildKeyframeIndex();
+    void seekStream(double targetTime);
+    void reportSeek(double landedTime);
+
+    // decoder, a packet without data marks the end of stream
+    PacketPool packetPool;
     struct Packet {
+        Packet() = default;
+        Packet(PacketPool* pool, AVPacket* data, int serial) : data(data), serial(serial), pool(pool) {}
+        Packet(Packet&& other) noexcept {
+            *this = std::move(other);
+        }
+        Packet& operator=(Packet&& other) noexcept {
+            if (this != &other) {
+                reset();
+                data = std::exchange(other.data, nullptr);
+                serial = other.serial;
+                pool = other.pool;
+            }
+            return *this;
+        }
+        Packet(const Packet&) = delete;
+        Packet& operator=(const Packet&) = delete;
         ~Packet() {
-            if (data) {
-                av_packet_unref(data);
+            reset();
+        }
+
+        void reset() {
+            if (pool) {
+                pool->release(data);
+            } else {
+                av_packet_free(&data);
             }
+            data = nullptr;
         }
+
         AVPacket* data = nullptr;
+        int serial = 0;
+        PacketPool* pool = nullptr;
     };
 
     struct DecoderInfo {
@@ -135,13 +476,15 @@ private:
             maxFrameQueueSize = maxFrameSize;
             frameQueue.set_max_size(maxFrameQueueSize);
         }
-        ThreadSafeQueue<std::shared_ptr<Packet>> packetQueue;
+        ThreadSafeQueue<Packet> packetQueue;
         AVCodecContext* pAVCtx = nullptr;
         ThreadSafeQueue<std::shared_ptr<Frame>> frameQueue;
         size_t maxFrameQueueSize = 0;
         std::thread decodeThread;
         std::atomic<bool> threadRunning = false;
         std::atomic<bool> threadStopped = false;
+        // every frame up to the end of stream has been received from the codec
+        std::atomic<bool> drained = false;
     };
 
     DecoderInfo videoDecoder;
@@ -156,15 +499,30 @@ private:
     };
     AudioParams audioSrc{}, audioDst{};
 
-    // data about video stream
+    // data about video stream, the sws context is used by the draw thread through convertFrame
+    std::mutex mutexSws;
     SwsContext* pSwsCtx = nullptr;
+    bool swsReleased = false;
+    std::atomic<int> outputWidth = 0, outputHeight = 0;
     int fps_den, fps_num;
     int width, height;
 
 
     void readPacket();
+    void readAudioPacket();
+    void decideDemuxing();
+    bool measureInterleave(double& skew);
+    bool readInterleave(double& skew, double& audioPacketDuration);
+    bool openAudioDemuxer();
+    bool pushPacket(DecoderInfo& decoder, Packet&& packet);
+    void flushDecoder(DecoderInfo& decoder, std::mutex& codecMutex);
+    bool drainDecoders(bool untilPlayed = true);
     void videoDecode();
     void audioDecode();
+    bool waitPacket(DecoderInfo& decoder, Packet& packet);
+    bool queueVideoFrame(AVFrame* pAVframe, int serial);
+    bool queueAudioFrame(AVFrame* pAVframe, int serial);
+    bool pushAudioFrame(uint8_t* data, int size, int samples, int64_t pts, double time, double frameSpeed, int serial);
 };
 
 
@@ -0,0 +1,365 @@
+#include "GopCache.h"
+#include "ProbeCache.h"
+
+#include <algorithm>
+#include <cstdint>
+
+GopCache::GopCache(const std::string& filename, int streamIndex, const AVCodecParameters* codecpar,
+    KeyframeIndex& keyframeIndex, size_t memoryBudget)
+    : filename(filename), streamIndex(streamIndex), keyframeIndex(keyframeIndex), memoryBudget(memoryBudget) {
+    this->codecpar = avcodec_parameters_alloc();
+    avcodec_parameters_copy(this->codecpar, codecpar);
+}
+
+GopCache::~GopCache() {
+    stop();
+    avcodec_parameters_free(&codecpar);
+}
+
+void GopCache::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    workerThread = std::thread(&GopCache::worker, this);
+}
+
+void GopCache::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    changed.notify_all();
+    if (workerThread.joinable()) {
+        workerThread.join();
+    }
+}
+
+std::shared_ptr<FFmpegDecoder::Frame> GopCache::frameAt(int64_t pts, bool& missing) {
+    std::lock_guard<std::mutex> lock(mutex);
+    missing = false;
+    return lookup(pts, missing);
+}
+
+std::shared_ptr<FFmpegDecoder::Frame> GopCache::next(int64_t pts, bool& missing) {
+    std::lock_guard<std::mutex> lock(mutex);
+    missing = false;
+    const Gop* gop = find(pts);
+    if (gop == nullptr) {
+        return lookup(pts, missing);
+    }
+    auto it = std::upper_bound(gop->frames.begin(), gop->frames.end(), pts,
+        [](int64_t value, const std::shared_ptr<FFmpegDecoder::Frame>& frame) { return value < frame->videoPts; });
+    if (it != gop->frames.end()) {
+        return *it;
+    }
+    if (gop->end == INT64_MAX) {
+        return nullptr;
+    }
+
+    // the first frame of the following GOP
+    const Gop* following = find(gop->end);
+    if (following == nullptr) {
+        return lookup(gop->end, missing);
+    }
+    return following->frames.empty() ? nullptr : following->frames.front();
+}
+
+std::shared_ptr<FFmpegDecoder::Frame> GopCache::previous(int64_t pts, bool& missing) {
+    std::lock_guard<std::mutex> lock(mutex);
+    missing = false;
+    return lookup(pts - 1, missing);
+}
+
+void GopCache::setPosition(int64_t pts, int direction) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        position = pts;
+        this->direction = direction;
+    }
+    changed.notify_all();
+}
+
+const GopCache::Gop* GopCache::find(int64_t pts) const {
+    auto it = gops.upper_bound(pts);
+    if (it == gops.begin()) {
+        return nullptr;
+    }
+    --it;
+    return pts < it->second.end ? &it->second : nullptr;
+}
+
+std::shared_ptr<FFmpegDecoder::Frame> GopCache::lookup(int64_t pts, bool& missing) {
+    if (failed) {
+        return nullptr;
+    }
+    const Gop* gop = find(pts);
+    if (gop == nullptr) {
+        missing = true;
+        needed = pts;
+        changed.notify_all();
+        return nullptr;
+    }
+    auto it = std::upper_bound(gop->frames.begin(), gop->frames.end(), pts,
+        [](int64_t value, const std::shared_ptr<FFmpegDecoder::Frame>& frame) { return value < frame->videoPts; });
+    return it == gop->frames.begin() ? nullptr : *std::prev(it);
+}
+
+int64_t GopCache::prefetchTarget() {
+    if (position == AV_NOPTS_VALUE) {
+        return AV_NOPTS_VALUE;
+    }
+    const Gop* gop = find(position);
+    if (gop == nullptr || gop->frames.empty()) {
+        return AV_NOPTS_VALUE;
+    }
+
+    // a GOP starting before its first frame is the beginning of the file
+    int64_t target;
+    if (direction < 0) {
+        if (gop->start < gop->frames.front()->videoPts) {
+            return AV_NOPTS_VALUE;
+        }
+        target = gop->start - 1;
+    } else {
+        if (gop->end == INT64_MAX) {
+            return AV_NOPTS_VALUE;
+        }
+        target = gop->end;
+    }
+    if (find(target)) {
+        return AV_NOPTS_VALUE;
+    }
+
+    // only when a GOP of about the same size fits next to the current one
+    if (usedBytes + gop->bytes > memoryBudget) {
+        evict(gop->start);
+        if (usedBytes + gop->bytes > memoryBudget) {
+            return AV_NOPTS_VALUE;
+        }
+    }
+    return target;
+}
+
+void GopCache::worker() {
+    bool opened = open();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!opened) {
+        failed = true;
+        lock.unlock();
+        close();
+        return;
+    }
+
+    while (running) {
+        // what a lookup is waiting for comes before the prefetch
+        int64_t target = needed != AV_NOPTS_VALUE && !find(needed) ? needed : AV_NOPTS_VALUE;
+        needed = AV_NOPTS_VALUE;
+        if (target == AV_NOPTS_VALUE) {
+            target = prefetchTarget();
+        }
+        if (target == AV_NOPTS_VALUE) {
+            changed.wait(lock);
+            continue;
+        }
+        if (position == AV_NOPTS_VALUE) {
+            position = target;
+        }
+
+        lock.unlock();
+        Gop gop = decode(target);
+        lock.lock();
+
+        if (!gops.count(gop.start)) {
+            int64_t start = gop.start;
+            usedBytes += gop.bytes;
+            gops.emplace(start, std::move(gop));
+            evict(start);
+        }
+    }
+
+    lock.unlock();
+    close();
+}
+
+bool GopCache::open() {
+    if (avformat_open_input(&pFormatCtx, filename.data(), nullptr, nullptr)) {
+        return false;
+    }
+    // probed like the player's own demuxer, containers that need it have incomplete timestamps otherwise
+    ProbeCache probeCache(filename);
+    ProbeCache::Entry entry;
+    if (!(probeCache.valid() && probeCache.load(entry) && ProbeCache::apply(entry, pFormatCtx))
+        && avformat_find_stream_info(pFormatCtx, nullptr) < 0) {
+        return false;
+    }
+    if (streamIndex >= static_cast<int>(pFormatCtx->nb_streams)) {
+        return false;
+    }
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        pFormatCtx->streams[i]->discard = (static_cast<int>(i) == streamIndex) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    const AVCodec* pCodec = avcodec_find_decoder(codecpar->codec_id);
+    if (pCodec == nullptr) {
+        return false;
+    }
+    pAVCtx = avcodec_alloc_context3(pCodec);
+    avcodec_parameters_to_context(pAVCtx, codecpar);
+    // the output is waiting on these frames, use every core
+    pAVCtx->thread_count = 0;
+    return avcodec_open2(pAVCtx, pCodec, nullptr) >= 0;
+}
+
+void GopCache::close() {
+    avcodec_free_context(&pAVCtx);
+    avformat_close_input(&pFormatCtx);
+}
+
+GopCache::Gop GopCache::decode(int64_t target) {
+    Gop gop{target, INT64_MAX, {}, 0};
+
+    int64_t seekPts = target;
+    if (keyframeIndex.complete()) {
+        keyframeIndex.findPrior(target, seekPts);
+    }
+    if (av_seek_frame(pFormatCtx, streamIndex, seekPts, AVSEEK_FLAG_BACKWARD) < 0) {
+        gop.end = target + 1;
+        return gop;
+    }
+    avcodec_flush_buffers(pAVCtx);
+
+    // frames already cached are skipped; a GOP past half the budget is cut into segments, the
+    // frames before the target are dropped from the front until the segment reaches it
+    int64_t keyframePts = AV_NOPTS_VALUE;
+    int64_t keepUntil = INT64_MAX;
+    int64_t cut = INT64_MAX;
+    size_t maxBytes = memoryBudget / 2;
+
+    // converted to RGBA as well once it is shown, the source is kept for converting again after a resize;
+    // 0 for formats av_image can't size (hardware frames), those aren't cached
+    auto frameBytes = [](const AVFrame* frame) -> size_t {
+        int sourceBytes = av_image_get_buffer_size(static_cast<AVPixelFormat>(frame->format), frame->width, frame->height, 1);
+        int rgbaBytes = av_image_get_buffer_size(AV_PIX_FMT_RGBA, frame->width, frame->height, 1);
+        if (sourceBytes < 0 || rgbaBytes < 0) {
+            return 0;
+        }
+        return static_cast<size_t>(sourceBytes) + static_cast<size_t>(rgbaBytes);
+    };
+
+    AVPacket* pAVpkt = av_packet_alloc();
+    AVFrame* pAVframe = av_frame_alloc();
+    auto receive = [&] {
+        while (avcodec_receive_frame(pAVCtx, pAVframe) == 0) {
+            int64_t pts = pAVframe->best_effort_timestamp;
+            if (pts == AV_NOPTS_VALUE || pts < gop.start || pts >= std::min({gop.end, keepUntil, cut})) {
+                av_frame_unref(pAVframe);
+                continue;
+            }
+            size_t bytes = frameBytes(pAVframe);
+            if (bytes == 0) {
+                av_frame_unref(pAVframe);
+                continue;
+            }
+            if (!gop.frames.empty() && gop.frames.back()->videoPts >= target && gop.bytes + bytes > maxBytes) {
+                cut = pts;
+                av_frame_unref(pAVframe);
+                continue;
+            }
+            size_t dropped = 0;
+            while (dropped < gop.frames.size() && gop.bytes + bytes > maxBytes) {
+                gop.bytes -= frameBytes(gop.frames[dropped]->source);
+                dropped++;
+            }
+            if (dropped > 0) {
+                gop.frames.erase(gop.frames.begin(), gop.frames.begin() + static_cast<std::ptrdiff_t>(dropped));
+                gop.start = gop.frames.empty() ? pts : gop.frames.front()->videoPts;
+            }
+
+            auto frame = std::make_shared<FFmpegDecoder::Frame>();
+            frame->source = av_frame_alloc();
+            av_frame_move_ref(frame->source, pAVframe);
+            frame->videoPts = pts;
+            frame->immediate = true;
+            frame->keepSource = true;
+            gop.frames.push_back(std::move(frame));
+            gop.bytes += bytes;
+        }
+    };
+
+    while (running && cut == INT64_MAX && av_read_frame(pFormatCtx, pAVpkt) >= 0) {
+        if (pAVpkt->stream_index != streamIndex) {
+            av_packet_unref(pAVpkt);
+            continue;
+        }
+        int64_t pts = pAVpkt->pts != AV_NOPTS_VALUE ? pAVpkt->pts : pAVpkt->dts;
+        bool isKeyframe = pAVpkt->flags & AV_PKT_FLAG_KEY;
+
+        if (keyframePts == AV_NOPTS_VALUE) {
+            if (!isKeyframe) {
+                av_packet_unref(pAVpkt);
+                continue;
+            }
+            keyframePts = pts;
+
+            // a demuxer landing past the target has no earlier keyframe, the GOP starts at the target then
+            std::lock_guard<std::mutex> lock(mutex);
+            gop.start = std::min(pts, target);
+            while (const Gop* cached = find(gop.start)) {
+                gop.start = cached->end;
+            }
+            auto following = gops.upper_bound(gop.start);
+            keepUntil = following != gops.end() ? following->first : INT64_MAX;
+        } else if (isKeyframe && gop.end == INT64_MAX && pts > keyframePts) {
+            // the next GOP, its leading pictures are still decoded, they can show before its keyframe
+            gop.end = pts;
+        } else if (gop.end != INT64_MAX && pts != AV_NOPTS_VALUE && pts > gop.end) {
+            av_packet_unref(pAVpkt);
+            break;
+        }
+
+        while (avcodec_send_packet(pAVCtx, pAVpkt) == AVERROR(EAGAIN)) {
+            receive();
+        }
+        receive();
+        av_packet_unref(pAVpkt);
+    }
+    if (cut == INT64_MAX && avcodec_send_packet(pAVCtx, nullptr) >= 0) {
+        receive();
+    }
+    avcodec_flush_buffers(pAVCtx);
+    av_packet_free(&pAVpkt);
+    av_frame_free(&pAVframe);
+
+    std::sort(gop.frames.begin(), gop.frames.end(),
+        [](const std::shared_ptr<FFmpegDecoder::Frame>& a, const std::shared_ptr<FFmpegDecoder::Frame>& b) {
+            return a->videoPts < b->videoPts;
+        });
+    gop.end = std::min({gop.end, keepUntil, cut});
+    // always covers the target, so it isn't asked for again
+    gop.start = std::min(gop.start, target);
+    gop.end = std::max(gop.end, target + 1);
+    return gop;
+}
+
+void GopCache::evict(int64_t keep) {
+    while (usedBytes > memoryBudget && position != AV_NOPTS_VALUE) {
+        auto farthest = gops.end();
+        int64_t farthestDistance = 0;
+        for (auto it = gops.begin(); it != gops.end(); ++it) {
+            const Gop& gop = it->second;
+            int64_t distance = position < gop.start ? gop.start - position
+                : position >= gop.end ? position - gop.end + 1 : 0;
+            if (gop.start != keep && distance > farthestDistance) {
+                farthest = it;
+                farthestDistance = distance;
+            }
+        }
+        if (farthest == gops.end()) {
+            break;
+        }
+        usedBytes -= farthest->second.bytes;
+        gops.erase(farthest);
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef VK_SDL2_VP_GOPCACHE_H
+#define VK_SDL2_VP_GOPCACHE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FFmpegDecoder.h"
+
+// Decoded frames of whole GOPs for frame stepping and reverse play. A worker with its own demuxer
+// decodes a GOP forward from its keyframe once, after that its frames are served in any order.
+// Lookups that miss ask the worker for the GOP and return nothing until it is decoded; the GOP
+// next to the current one in the direction of travel is decoded ahead. Bounded by a memory
+// budget, the GOPs farthest from the current position are dropped first.
+class GopCache {
+public:
+    GopCache(const std::string& filename, int streamIndex, const AVCodecParameters* codecpar,
+             KeyframeIndex& keyframeIndex, size_t memoryBudget);
+    ~GopCache();
+
+    // the worker is only started once frames are asked for
+    void start();
+
+    void stop();
+
+    // frames in the stream's time base; missing is set when the frame isn't decoded yet, a null
+    // frame without it means there is no such frame in the file
+    // last frame at or before pts, the one on screen at that time
+    std::shared_ptr<FFmpegDecoder::Frame> frameAt(int64_t pts, bool& missing);
+    // first frame after pts
+    std::shared_ptr<FFmpegDecoder::Frame> next(int64_t pts, bool& missing);
+    // last frame before pts
+    std::shared_ptr<FFmpegDecoder::Frame> previous(int64_t pts, bool& missing);
+
+    // where frames are taken from and in which direction, for the prefetch and the eviction
+    void setPosition(int64_t pts, int direction);
+
+private:
+    // frames with start <= pts < end in presentation order, end is INT64_MAX for the last GOP;
+    // a GOP decoded only partly to stay in budget is a segment of it
+    struct Gop {
+        int64_t start;
+        int64_t end;
+        std::vector<std::shared_ptr<FFmpegDecoder::Frame>> frames;
+        size_t bytes;
+    };
+
+    std::string filename;
+    int streamIndex;
+    AVCodecParameters* codecpar;
+    KeyframeIndex& keyframeIndex;
+    size_t memoryBudget;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<int64_t, Gop> gops;
+    size_t usedBytes = 0;
+    int64_t needed = AV_NOPTS_VALUE;
+    int64_t position = AV_NOPTS_VALUE;
+    int direction = 1;
+    bool failed = false;
+
+    std::atomic<bool> running = false;
+    std::thread workerThread;
+
+    AVFormatContext* pFormatCtx = nullptr;
+    AVCodecContext* pAVCtx = nullptr;
+
+    const Gop* find(int64_t pts) const;
+    std::shared_ptr<FFmpegDecoder::Frame> lookup(int64_t pts, bool& missing);
+    int64_t prefetchTarget();
+
+    void worker();
+    bool open();
+    void close();
+    Gop decode(int64_t target);
+    // drops the GOPs farthest from the position until in budget, never the one at the position or keep
+    void evict(int64_t keep);
+};
+
+
+#endif //VK_SDL2_VP_GOPCACHE_H
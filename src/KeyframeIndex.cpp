@@ -0,0 +1,85 @@
+#include "KeyframeIndex.h"
+
+#include <algorithm>
+#include <iostream>
+
+KeyframeIndex::~KeyframeIndex() {
+    stop();
+}
+
+void KeyframeIndex::load(const Keyframes& keyframes, bool complete) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->keyframes = keyframes;
+    std::sort(this->keyframes.begin(), this->keyframes.end(),
+        [](const ProbeCache::Keyframe& a, const ProbeCache::Keyframe& b) { return a.pts < b.pts; });
+    complete_ = complete;
+}
+
+void KeyframeIndex::build(const std::string& filename, int streamIndex, std::function<void(const Keyframes&)> onComplete) {
+    if (complete_ || scanThread.joinable()) {
+        return;
+    }
+    running = true;
+    scanThread = std::thread(&KeyframeIndex::scan, this, filename, streamIndex, std::move(onComplete));
+}
+
+void KeyframeIndex::stop() {
+    running = false;
+    if (scanThread.joinable()) {
+        scanThread.join();
+    }
+}
+
+bool KeyframeIndex::complete() {
+    return complete_;
+}
+
+bool KeyframeIndex::findPrior(int64_t pts, int64_t& keyframePts) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::upper_bound(keyframes.begin(), keyframes.end(), pts,
+        [](int64_t value, const ProbeCache::Keyframe& keyframe) { return value < keyframe.pts; });
+    if (it == keyframes.begin()) {
+        return false;
+    }
+    keyframePts = std::prev(it)->pts;
+    return true;
+}
+
+void KeyframeIndex::scan(std::string filename, int streamIndex, std::function<void(const Keyframes&)> onComplete) {
+    AVFormatContext* pFormatCtx = nullptr;
+    if (avformat_open_input(&pFormatCtx, filename.data(), nullptr, nullptr)) {
+        return;
+    }
+    if (streamIndex >= static_cast<int>(pFormatCtx->nb_streams)) {
+        avformat_close_input(&pFormatCtx);
+        return;
+    }
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        pFormatCtx->streams[i]->discard = (static_cast<int>(i) == streamIndex) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    Keyframes found;
+    AVPacket* pAVpkt = av_packet_alloc();
+    while (running && av_read_frame(pFormatCtx, pAVpkt) >= 0) {
+        if (pAVpkt->stream_index == streamIndex && (pAVpkt->flags & AV_PKT_FLAG_KEY)) {
+            int64_t pts = pAVpkt->pts != AV_NOPTS_VALUE ? pAVpkt->pts : pAVpkt->dts;
+            if (pts != AV_NOPTS_VALUE) {
+                found.push_back({pts, pAVpkt->pos});
+            }
+        }
+        av_packet_unref(pAVpkt);
+    }
+    av_packet_free(&pAVpkt);
+    avformat_close_input(&pFormatCtx);
+
+    if (!running) {
+        return;
+    }
+
+    load(found, true);
+    std::cout << "keyframe index built: " << found.size() << " keyframes" << std::endl;
+    if (onComplete) {
+        std::lock_guard<std::mutex> lock(mutex);
+        onComplete(keyframes);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef VK_SDL2_VP_KEYFRAMEINDEX_H
+#define VK_SDL2_VP_KEYFRAMEINDEX_H
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ProbeCache.h"
+
+// Keyframe positions of one stream. Seeded from the probe cache and completed by a
+// background scan of the file that only demuxes, nothing is decoded.
+class KeyframeIndex {
+public:
+    using Keyframes = std::vector<ProbeCache::Keyframe>;
+
+    KeyframeIndex() = default;
+    ~KeyframeIndex();
+
+    void load(const Keyframes& keyframes, bool complete);
+
+    // starts the scan unless it is complete or already running, onComplete runs on the scan thread
+    void build(const std::string& filename, int streamIndex, std::function<void(const Keyframes&)> onComplete);
+    void stop();
+
+    bool complete();
+
+    // last keyframe at or before pts, in the stream's time base
+    bool findPrior(int64_t pts, int64_t& keyframePts);
+
+private:
+    std::mutex mutex;
+    Keyframes keyframes;
+
+    std::atomic<bool> complete_ = false;
+    std::atomic<bool> running = false;
+    std::thread scanThread;
+
+    void scan(std::string filename, int streamIndex, std::function<void(const Keyframes&)> onComplete);
+};
+
+
+#endif //VK_SDL2_VP_KEYFRAMEINDEX_H
@@ -0,0 +1,169 @@
+#include "LoopCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+LoopCache::LoopCache(size_t memoryBudget) : memoryBudget(memoryBudget) {
+    // never so much that the machine would rather swap than seek
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0) {
+        this->memoryBudget = std::min(memoryBudget, static_cast<size_t>(pages) * static_cast<size_t>(pageSize) / 2);
+    }
+}
+
+void LoopCache::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    clear();
+    exceeded = false;
+}
+
+void LoopCache::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+    clear();
+}
+
+void LoopCache::expect(size_t segmentBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!exceeded && segmentBytes > memoryBudget) {
+        std::printf("loop segment needs about %.0lf MB, more than the %.0lf MB cache, looping by seeking\n",
+            segmentBytes / (1024.0 * 1024.0), memoryBudget / (1024.0 * 1024.0));
+        clear();
+        exceeded = true;
+    }
+}
+
+void LoopCache::add(const std::shared_ptr<FFmpegDecoder::Frame>& frame, double time, double duration, bool video) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (exceeded) {
+        return;
+    }
+
+    // video keeps only the decoder output, a reference to it is converted for each pass
+    size_t frameBytes = sizeof(FFmpegDecoder::Frame);
+    std::shared_ptr<FFmpegDecoder::Frame> entry = frame;
+    if (video) {
+        int sourceBytes = frame->source ? av_image_get_buffer_size(
+            static_cast<AVPixelFormat>(frame->source->format), frame->source->width, frame->source->height, 1) : -1;
+        // hardware frames can't be sized, nor kept without holding up the decoder's pool
+        if (sourceBytes < 0) {
+            clear();
+            exceeded = true;
+            return;
+        }
+        frameBytes += static_cast<size_t>(sourceBytes);
+    } else {
+        frameBytes += static_cast<size_t>(frame->audioBufferSize);
+    }
+    if (usedBytes + frameBytes > memoryBudget) {
+        std::printf("loop segment exceeds the %.0lf MB cache, looping by seeking\n", memoryBudget / (1024.0 * 1024.0));
+        clear();
+        exceeded = true;
+        return;
+    }
+    usedBytes += frameBytes;
+    if (video) {
+        entry = std::make_shared<FFmpegDecoder::Frame>();
+        entry->source = av_frame_clone(frame->source);
+        entry->videoPts = frame->videoPts;
+    }
+
+    if (videoEntries.empty() && audioEntries.empty()) {
+        firstTime = time;
+        lastEnd = time;
+    }
+    firstTime = std::min(firstTime, time);
+    lastEnd = std::max(lastEnd, time + duration);
+    (video ? videoEntries : audioEntries).push_back(Entry{std::move(entry), time});
+}
+
+bool LoopCache::usable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return !exceeded && (!videoEntries.empty() || !audioEntries.empty());
+}
+
+bool LoopCache::overBudget() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return exceeded;
+}
+
+double LoopCache::span() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lastEnd - firstTime;
+}
+
+size_t LoopCache::frameCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return videoEntries.size() + audioEntries.size();
+}
+
+size_t LoopCache::bytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return usedBytes;
+}
+
+bool LoopCache::peek(std::shared_ptr<FFmpegDecoder::Frame>& frame, double& time, bool& video) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (videoEntries.empty() && audioEntries.empty()) {
+        return false;
+    }
+    video = nextIsVideo();
+    const Entry& entry = video ? videoEntries[videoPos] : audioEntries[audioPos];
+    frame = entry.frame;
+    time = entry.time;
+    return true;
+}
+
+bool LoopCache::advance() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (videoEntries.empty() && audioEntries.empty()) {
+        return false;
+    }
+    if (nextIsVideo()) {
+        videoPos++;
+    } else {
+        audioPos++;
+    }
+    if (videoPos >= videoEntries.size() && audioPos >= audioEntries.size()) {
+        videoPos = 0;
+        audioPos = 0;
+        return true;
+    }
+    return false;
+}
+
+void LoopCache::seek(double time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto firstAt = [time](const std::vector<Entry>& entries) {
+        auto it = std::find_if(entries.begin(), entries.end(), [time](const Entry& entry) { return entry.time >= time; });
+        return static_cast<size_t>(it - entries.begin());
+    };
+    videoPos = firstAt(videoEntries);
+    audioPos = firstAt(audioEntries);
+    if (videoPos >= videoEntries.size() && audioPos >= audioEntries.size()) {
+        videoPos = 0;
+        audioPos = 0;
+    }
+}
+
+void LoopCache::clear() {
+    videoEntries.clear();
+    audioEntries.clear();
+    videoEntries.shrink_to_fit();
+    audioEntries.shrink_to_fit();
+    usedBytes = 0;
+    firstTime = lastEnd = 0.0;
+    videoPos = audioPos = 0;
+}
+
+bool LoopCache::nextIsVideo() {
+    // a stream that has finished its pass waits for the other one
+    if (videoPos >= videoEntries.size()) {
+        return false;
+    }
+    if (audioPos >= audioEntries.size()) {
+        return true;
+    }
+    return videoEntries[videoPos].time <= audioEntries[audioPos].time;
+}
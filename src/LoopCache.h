@@ -0,0 +1,70 @@
+#ifndef VK_SDL2_VP_LOOPCACHE_H
+#define VK_SDL2_VP_LOOPCACHE_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "FFmpegDecoder.h"
+
+// Decoded video frames and PCM of a loop segment, captured during its first pass so that later
+// passes are fed to the output queues without demuxing or decoding anything. Video is kept as
+// the decoder output only, each pass converts a reference to it for display and releases that.
+// Going over the memory budget drops the capture, the segment is looped by seeking then.
+class LoopCache {
+public:
+    explicit LoopCache(size_t memoryBudget);
+
+    // empties the cache and starts a new capture, also for a segment that didn't fit before
+    void reset();
+
+    // throws the capture away, but keeps a segment marked as too large
+    void restart();
+
+    // the decoded size of the segment about to be captured, one that can't fit isn't captured at all
+    void expect(size_t segmentBytes);
+
+    // frames come in decode order per stream, duration is how long the frame plays, in seconds
+    void add(const std::shared_ptr<FFmpegDecoder::Frame>& frame, double time, double duration, bool video);
+
+    // nothing captured, or the capture went over budget
+    bool usable();
+    bool overBudget();
+
+    // seconds from the first cached frame to the end of the last one, the length of one pass
+    double span();
+
+    size_t frameCount();
+    size_t bytes();
+
+    // replay: the frame due next over both streams, wrapping around at the end of the segment
+    bool peek(std::shared_ptr<FFmpegDecoder::Frame>& frame, double& time, bool& video);
+    // moves past the frame returned by peek, true when that starts a new pass
+    bool advance();
+    // positions the replay at the first frames at or after time
+    void seek(double time);
+
+private:
+    struct Entry {
+        std::shared_ptr<FFmpegDecoder::Frame> frame;
+        double time;
+    };
+
+    std::mutex mutex;
+    size_t memoryBudget;
+    size_t usedBytes = 0;
+    bool exceeded = false;
+    std::vector<Entry> videoEntries;
+    std::vector<Entry> audioEntries;
+    double firstTime = 0.0;
+    double lastEnd = 0.0;
+
+    size_t videoPos = 0;
+    size_t audioPos = 0;
+
+    void clear();
+    bool nextIsVideo();
+};
+
+
+#endif //VK_SDL2_VP_LOOPCACHE_H
@@ -0,0 +1,321 @@
+#include "MediaIO.h"
+
+extern "C"
+{
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// size of the buffer between the AVIOContext and the backend
+static const int IO_BUFFER_SIZE = 256 * 1024;
+
+namespace {
+
+class MmapIO : public MediaIO {
+public:
+    MmapIO(int fd, int64_t fileSize) : MediaIO("mmap", fileSize) {
+        data = static_cast<uint8_t*>(mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ, MAP_PRIVATE, fd, 0));
+        syscalls++;
+        if (data == MAP_FAILED) {
+            data = nullptr;
+            return;
+        }
+        madvise(data, static_cast<size_t>(fileSize), MADV_SEQUENTIAL);
+        syscalls++;
+        adviseAhead();
+    }
+
+    ~MmapIO() override {
+        if (data) {
+            munmap(data, static_cast<size_t>(fileSize));
+        }
+    }
+
+    bool mapped() const {
+        return data != nullptr;
+    }
+
+protected:
+    int read(uint8_t* buffer, int size) override {
+        int64_t count = std::min<int64_t>(size, fileSize - position);
+        if (count <= 0) {
+            return 0;
+        }
+        std::memcpy(buffer, data + position, static_cast<size_t>(count));
+        position += count;
+        if (position >= advisedUntil - ADVISE_WINDOW / 2) {
+            adviseAhead();
+        }
+        return static_cast<int>(count);
+    }
+
+    void seek(int64_t newPosition) override {
+        position = newPosition;
+        advisedUntil = position;
+        adviseAhead();
+    }
+
+private:
+    // pages ahead of the read position the kernel is asked to fetch
+    static constexpr int64_t ADVISE_WINDOW = 16 * 1024 * 1024;
+
+    uint8_t* data = nullptr;
+    int64_t advisedUntil = 0;
+
+    void adviseAhead() {
+        static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+        int64_t begin = std::max(position, advisedUntil) / pageSize * pageSize;
+        int64_t end = std::min(position + ADVISE_WINDOW, fileSize);
+        if (advisedUntil < end) {
+            madvise(data + begin, static_cast<size_t>(end - begin), MADV_WILLNEED);
+            syscalls++;
+            advisedUntil = end;
+        }
+    }
+};
+
+class ReadAheadIO : public MediaIO {
+public:
+    ReadAheadIO(int fd, int64_t fileSize, size_t window)
+        : MediaIO("read-ahead", fileSize), fd(fd), window(std::max<size_t>(window, CHUNK_SIZE)) {
+        workerThread = std::thread(&ReadAheadIO::worker, this);
+    }
+
+    ~ReadAheadIO() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        changed.notify_all();
+        workerThread.join();
+        close(fd);
+    }
+
+protected:
+    int read(uint8_t* buffer, int size) override {
+        if (position >= fileSize) {
+            return 0;
+        }
+        int64_t index = position / CHUNK_SIZE;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this, index] { return failedChunk == index || chunks.count(index); });
+        if (failedChunk == index) {
+            return AVERROR(EIO);
+        }
+        const std::vector<uint8_t>& chunk = chunks[index];
+        int64_t offset = position - index * CHUNK_SIZE;
+        int64_t count = std::min<int64_t>(size, static_cast<int64_t>(chunk.size()) - offset);
+        std::memcpy(buffer, chunk.data() + offset, static_cast<size_t>(count));
+        position += count;
+        lock.unlock();
+
+        // the window moved, let the worker drop and fetch chunks
+        changed.notify_all();
+        return static_cast<int>(count);
+    }
+
+    void seek(int64_t newPosition) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            position = newPosition;
+            // a chunk that couldn't be read is tried again
+            failedChunk = -1;
+        }
+        changed.notify_all();
+    }
+
+private:
+    static constexpr int64_t CHUNK_SIZE = 1024 * 1024;
+
+    int fd;
+    size_t window;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<int64_t, std::vector<uint8_t>> chunks;
+    bool running = true;
+    // chunk the last fetch failed for, reads of it fail until the next seek
+    int64_t failedChunk = -1;
+    std::thread workerThread;
+
+    void worker() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            // keep one chunk behind the position for short backward seeks
+            int64_t first = position / CHUNK_SIZE;
+            int64_t last = std::min((position + static_cast<int64_t>(window)) / CHUNK_SIZE, (fileSize - 1) / CHUNK_SIZE);
+            for (auto it = chunks.begin(); it != chunks.end();) {
+                it = (it->first < first - 1 || it->first > last) ? chunks.erase(it) : std::next(it);
+            }
+
+            int64_t missing = -1;
+            for (int64_t index = first; index <= last; ++index) {
+                if (!chunks.count(index) && index != failedChunk) {
+                    missing = index;
+                    break;
+                }
+            }
+            if (missing < 0) {
+                changed.wait(lock);
+                continue;
+            }
+
+            lock.unlock();
+            std::vector<uint8_t> chunk(static_cast<size_t>(std::min(CHUNK_SIZE, fileSize - missing * CHUNK_SIZE)));
+            bool ok = fetch(missing * CHUNK_SIZE, chunk);
+            lock.lock();
+
+            if (ok) {
+                chunks[missing] = std::move(chunk);
+            } else {
+                failedChunk = missing;
+            }
+            changed.notify_all();
+        }
+    }
+
+    bool fetch(int64_t offset, std::vector<uint8_t>& chunk) {
+        size_t done = 0;
+        while (done < chunk.size()) {
+            ssize_t ret = pread(fd, chunk.data() + done, chunk.size() - done, offset + static_cast<int64_t>(done));
+            syscalls++;
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(ret);
+        }
+        return true;
+    }
+};
+
+}
+
+MediaIO* MediaIO::create(const std::string& filename, Backend backend, size_t readAheadWindow) {
+    if (backend == Backend::Default) {
+        return nullptr;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    MediaIO* io = nullptr;
+    if (backend == Backend::Mmap) {
+        auto* mmapIO = new MmapIO(fd, st.st_size);
+        // the mapping stays valid without the descriptor
+        close(fd);
+        if (!mmapIO->mapped()) {
+            delete mmapIO;
+            return nullptr;
+        }
+        io = mmapIO;
+    } else {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        io = new ReadAheadIO(fd, st.st_size, readAheadWindow);
+    }
+
+    if (!io->init()) {
+        delete io;
+        return nullptr;
+    }
+    return io;
+}
+
+MediaIO::MediaIO(const char* name, int64_t fileSize) : name(name), fileSize(fileSize) {
+}
+
+MediaIO::~MediaIO() {
+    if (avioContext) {
+        av_freep(&avioContext->buffer);
+        avio_context_free(&avioContext);
+    }
+}
+
+bool MediaIO::init() {
+    auto* buffer = static_cast<uint8_t*>(av_malloc(IO_BUFFER_SIZE));
+    if (buffer == nullptr) {
+        return false;
+    }
+    avioContext = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, this, &MediaIO::readCallback, nullptr, &MediaIO::seekCallback);
+    if (avioContext == nullptr) {
+        av_free(buffer);
+        return false;
+    }
+    return true;
+}
+
+AVIOContext* MediaIO::context() {
+    return avioContext;
+}
+
+void MediaIO::printStats() const {
+    std::printf("io (%s): %.1lf MB read, %llu syscalls, %.1lf ms blocked in reads\n",
+        name, bytesRead / (1024.0 * 1024.0), static_cast<unsigned long long>(syscalls.load()),
+        readMicroseconds / 1000.0);
+}
+
+int MediaIO::readCallback(void* opaque, uint8_t* buffer, int size) {
+    auto* io = static_cast<MediaIO*>(opaque);
+    auto begin = std::chrono::steady_clock::now();
+    int ret = io->read(buffer, size);
+    io->readMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+    if (ret == 0) {
+        return AVERROR_EOF;
+    }
+    if (ret > 0) {
+        io->bytesRead += static_cast<uint64_t>(ret);
+    }
+    return ret;
+}
+
+int64_t MediaIO::seekCallback(void* opaque, int64_t offset, int whence) {
+    auto* io = static_cast<MediaIO*>(opaque);
+    if (whence & AVSEEK_SIZE) {
+        return io->fileSize;
+    }
+
+    int64_t target;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            target = offset;
+            break;
+        case SEEK_CUR:
+            target = io->position + offset;
+            break;
+        case SEEK_END:
+            target = io->fileSize + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    if (target < 0) {
+        return AVERROR(EINVAL);
+    }
+    io->seek(std::min(target, io->fileSize));
+    return io->position;
+}
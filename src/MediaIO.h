@@ -0,0 +1,66 @@
+#ifndef VK_SDL2_VP_MEDIAIO_H
+#define VK_SDL2_VP_MEDIAIO_H
+
+extern "C"
+{
+#include <libavformat/avio.h>
+}
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Custom AVIOContext for local files, replacing the file protocol's small synchronous reads
+// on the demux thread. The mmap backend maps the whole file and hints the kernel ahead of
+// the read position, the read-ahead backend keeps a window of the file in memory from a
+// worker thread so slow or network storage doesn't stall the demuxer directly.
+class MediaIO {
+public:
+    enum class Backend {
+        Default,
+        Mmap,
+        ReadAhead
+    };
+
+    // nullptr for Default or anything that isn't a regular file, ffmpeg opens those itself
+    static MediaIO* create(const std::string& filename, Backend backend, size_t readAheadWindow);
+
+    virtual ~MediaIO();
+
+    MediaIO(const MediaIO&) = delete;
+    MediaIO& operator=(const MediaIO&) = delete;
+
+    // to be set as AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO
+    AVIOContext* context();
+
+    void printStats() const;
+
+protected:
+    MediaIO(const char* name, int64_t fileSize);
+
+    bool init();
+
+    // reads at the current position, 0 at end of file, AVERROR on failure
+    virtual int read(uint8_t* buffer, int size) = 0;
+
+    virtual void seek(int64_t position) = 0;
+
+    const char* name;
+    int64_t fileSize;
+    int64_t position = 0;
+
+    // syscalls issued on behalf of the demuxer, counted by the backends
+    std::atomic<uint64_t> syscalls = 0;
+
+private:
+    AVIOContext* avioContext = nullptr;
+
+    // delivered to the demuxer, and the time it spent waiting for it
+    std::atomic<uint64_t> bytesRead = 0;
+    std::atomic<int64_t> readMicroseconds = 0;
+
+    static int readCallback(void* opaque, uint8_t* buffer, int size);
+    static int64_t seekCallback(void* opaque, int64_t offset, int whence);
+};
+
+
+#endif //VK_SDL2_VP_MEDIAIO_H
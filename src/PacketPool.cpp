@@ -0,0 +1,56 @@
+#include "PacketPool.h"
+
+#include <stdexcept>
+
+PacketPool::PacketPool(size_t maxFree) : maxFree(maxFree) {
+    freePackets.reserve(maxFree);
+}
+
+PacketPool::~PacketPool() {
+    for (AVPacket* packet : freePackets) {
+        av_packet_free(&packet);
+    }
+}
+
+AVPacket* PacketPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freePackets.empty()) {
+            AVPacket* packet = freePackets.back();
+            freePackets.pop_back();
+            return packet;
+        }
+        allocatedCount++;
+    }
+
+    AVPacket* packet = av_packet_alloc();
+    if (packet == nullptr) {
+        throw std::runtime_error("Couldn't allocate packet");
+    }
+    return packet;
+}
+
+void PacketPool::release(AVPacket* packet) {
+    if (packet == nullptr) {
+        return;
+    }
+    av_packet_unref(packet);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freePackets.size() < maxFree) {
+        freePackets.push_back(packet);
+        return;
+    }
+    allocatedCount--;
+    av_packet_free(&packet);
+}
+
+size_t PacketPool::allocated() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocatedCount;
+}
+
+size_t PacketPool::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return freePackets.size();
+}
@@ -0,0 +1,38 @@
+#ifndef VK_SDL2_VP_PACKETPOOL_H
+#define VK_SDL2_VP_PACKETPOOL_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+#include <mutex>
+#include <vector>
+
+// Recycles AVPacket structs between the demuxer and the decode threads, so steady-state
+// playback allocates none. Released packets are unreferenced, keeping at most maxFree of them.
+class PacketPool {
+public:
+    explicit PacketPool(size_t maxFree = 256);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    AVPacket* acquire();
+
+    void release(AVPacket* packet);
+
+    // packets alive, in use or free
+    size_t allocated();
+
+    size_t available();
+
+private:
+    std::mutex mutex;
+    std::vector<AVPacket*> freePackets;
+    size_t maxFree;
+    size_t allocatedCount = 0;
+};
+
+
+#endif //VK_SDL2_VP_PACKETPOOL_H
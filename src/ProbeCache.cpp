@@ -0,0 +1,272 @@
+#include "ProbeCache.h"
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+}
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "CacheDir.h"
+
+static const char* PROBE_CACHE_MAGIC = "vk_sdl2_vp-probe";
+static const int PROBE_CACHE_VERSION = 2;
+
+ProbeCache::ProbeCache(const std::string& filename) {
+    std::string fileKey = CacheDir::fileKey(filename);
+    if (fileKey.empty()) {
+        return;
+    }
+
+    auto dir = CacheDir::get("probe");
+    if (dir.empty()) {
+        return;
+    }
+    key = std::move(fileKey);
+    path = dir / (CacheDir::keyName(key) + ".txt");
+}
+
+bool ProbeCache::valid() const {
+    return !path.empty();
+}
+
+bool ProbeCache::load(Entry& entry) {
+    std::vector<char> data;
+    if (!valid() || !CacheDir::readFile(path, data)) {
+        return false;
+    }
+    std::istringstream in(std::string(data.begin(), data.end()));
+
+    std::string magic, line;
+    int version = 0;
+    in >> magic >> version;
+    std::getline(in, line);
+    if (magic != PROBE_CACHE_MAGIC || version != PROBE_CACHE_VERSION) {
+        return false;
+    }
+    // a hash collision or a renamed cache file must not be trusted
+    if (!std::getline(in, line) || line != "key " + key) {
+        return false;
+    }
+
+    entry = Entry{};
+    std::string tag;
+    while (in >> tag) {
+        if (tag == "duration") {
+            in >> entry.duration >> entry.startTime;
+        } else if (tag == "stream") {
+            StreamInfo si;
+            std::string extradata;
+            in >> si.codecType >> si.codecId >> si.codecTag >> si.format
+               >> si.width >> si.height >> si.sampleRate >> si.channels
+               >> si.bitRate >> si.profile >> si.level
+               >> si.timeBase.num >> si.timeBase.den
+               >> si.rFrameRate.num >> si.rFrameRate.den
+               >> si.avgFrameRate.num >> si.avgFrameRate.den
+               >> si.sampleAspectRatio.num >> si.sampleAspectRatio.den
+               >> si.startTime >> si.duration >> extradata;
+            if (extradata != "-") {
+                for (size_t i = 0; i + 1 < extradata.size(); i += 2) {
+                    si.extradata.push_back(static_cast<uint8_t>(std::stoi(extradata.substr(i, 2), nullptr, 16)));
+                }
+            }
+            entry.streams.push_back(std::move(si));
+        } else if (tag == "keyframes") {
+            size_t count = 0;
+            in >> entry.keyframeStream >> entry.keyframesComplete >> count;
+            entry.keyframes.resize(count);
+            for (auto& keyframe : entry.keyframes) {
+                in >> keyframe.pts >> keyframe.pos;
+            }
+        } else if (tag == "interleave") {
+            in >> entry.interleaveSkew >> entry.audioPacketDuration;
+        } else {
+            return false;
+        }
+        if (!in) {
+            return false;
+        }
+    }
+    return !entry.streams.empty();
+}
+
+void ProbeCache::store(const Entry& entry) {
+    if (!valid()) {
+        return;
+    }
+    std::ostringstream out;
+    out << PROBE_CACHE_MAGIC << " " << PROBE_CACHE_VERSION << "\n";
+    out << "key " << key << "\n";
+    out << "duration " << entry.duration << " " << entry.startTime << "\n";
+    for (const auto& si : entry.streams) {
+        out << "stream " << si.codecType << " " << si.codecId << " " << si.codecTag << " " << si.format
+            << " " << si.width << " " << si.height << " " << si.sampleRate << " " << si.channels
+            << " " << si.bitRate << " " << si.profile << " " << si.level
+            << " " << si.timeBase.num << " " << si.timeBase.den
+            << " " << si.rFrameRate.num << " " << si.rFrameRate.den
+            << " " << si.avgFrameRate.num << " " << si.avgFrameRate.den
+            << " " << si.sampleAspectRatio.num << " " << si.sampleAspectRatio.den
+            << " " << si.startTime << " " << si.duration << " ";
+        if (si.extradata.empty()) {
+            out << "-";
+        } else {
+            char hex[3];
+            for (uint8_t byte : si.extradata) {
+                std::snprintf(hex, sizeof(hex), "%02x", byte);
+                out << hex;
+            }
+        }
+        out << "\n";
+    }
+    if (entry.keyframeStream >= 0) {
+        out << "keyframes " << entry.keyframeStream << " " << entry.keyframesComplete
+            << " " << entry.keyframes.size() << "\n";
+        for (const auto& keyframe : entry.keyframes) {
+            out << keyframe.pts << " " << keyframe.pos << "\n";
+        }
+    }
+
+    if (entry.interleaveSkew >= 0.0) {
+        out << "interleave " << entry.interleaveSkew << " " << entry.audioPacketDuration << "\n";
+    }
+
+    auto text = out.str();
+    CacheDir::writeFile(path, text.data(), text.size());
+}
+
+void ProbeCache::capture(AVFormatContext* pFormatCtx, Entry& entry) {
+    entry = Entry{};
+    entry.duration = pFormatCtx->duration;
+    entry.startTime = pFormatCtx->start_time;
+
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        const AVStream* st = pFormatCtx->streams[i];
+        const AVCodecParameters* par = st->codecpar;
+
+        StreamInfo si;
+        si.codecType = par->codec_type;
+        si.codecId = par->codec_id;
+        si.codecTag = par->codec_tag;
+        si.format = par->format;
+        si.width = par->width;
+        si.height = par->height;
+        si.sampleRate = par->sample_rate;
+        si.channels = par->ch_layout.nb_channels;
+        si.bitRate = par->bit_rate;
+        si.profile = par->profile;
+        si.level = par->level;
+        si.timeBase = st->time_base;
+        si.rFrameRate = st->r_frame_rate;
+        si.avgFrameRate = st->avg_frame_rate;
+        si.sampleAspectRatio = par->sample_aspect_ratio;
+        si.startTime = st->start_time;
+        si.duration = st->duration;
+        if (par->extradata && par->extradata_size > 0) {
+            si.extradata.assign(par->extradata, par->extradata + par->extradata_size);
+        }
+        entry.streams.push_back(std::move(si));
+    }
+
+    // keyframe hints from the demuxer's own index, if the container has one
+    int videoIndex = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoIndex >= 0) {
+        AVStream* st = pFormatCtx->streams[videoIndex];
+        entry.keyframeStream = videoIndex;
+        int count = avformat_index_get_entries_count(st);
+        for (int i = 0; i < count; ++i) {
+            const AVIndexEntry* indexEntry = avformat_index_get_entry(st, i);
+            if (indexEntry->flags & AVINDEX_KEYFRAME) {
+                entry.keyframes.push_back({indexEntry->timestamp, indexEntry->pos});
+            }
+        }
+    }
+}
+
+bool ProbeCache::apply(const Entry& entry, AVFormatContext* pFormatCtx) {
+    if (entry.streams.size() != pFormatCtx->nb_streams) {
+        return false;
+    }
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        if (pFormatCtx->streams[i]->codecpar->codec_type != entry.streams[i].codecType) {
+            return false;
+        }
+    }
+
+    // only fill in what avformat_open_input couldn't find by itself
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        AVStream* st = pFormatCtx->streams[i];
+        AVCodecParameters* par = st->codecpar;
+        const StreamInfo& si = entry.streams[i];
+
+        if (par->codec_id == AV_CODEC_ID_NONE) {
+            par->codec_id = static_cast<AVCodecID>(si.codecId);
+        }
+        if (par->codec_tag == 0) {
+            par->codec_tag = si.codecTag;
+        }
+        if (par->format < 0) {
+            par->format = si.format;
+        }
+        if (par->width == 0 || par->height == 0) {
+            par->width = si.width;
+            par->height = si.height;
+        }
+        if (par->sample_rate == 0) {
+            par->sample_rate = si.sampleRate;
+        }
+        if (par->ch_layout.nb_channels == 0 && si.channels > 0) {
+            av_channel_layout_default(&par->ch_layout, si.channels);
+        }
+        if (par->bit_rate == 0) {
+            par->bit_rate = si.bitRate;
+        }
+        if (par->profile < 0) {
+            par->profile = si.profile;
+        }
+        if (par->level < 0) {
+            par->level = si.level;
+        }
+        if (par->sample_aspect_ratio.num == 0) {
+            par->sample_aspect_ratio = si.sampleAspectRatio;
+            st->sample_aspect_ratio = si.sampleAspectRatio;
+        }
+        if (!par->extradata && !si.extradata.empty()) {
+            par->extradata = static_cast<uint8_t*>(av_mallocz(si.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            std::memcpy(par->extradata, si.extradata.data(), si.extradata.size());
+            par->extradata_size = static_cast<int>(si.extradata.size());
+        }
+        if (st->r_frame_rate.num == 0) {
+            st->r_frame_rate = si.rFrameRate;
+        }
+        if (st->avg_frame_rate.num == 0) {
+            st->avg_frame_rate = si.avgFrameRate;
+        }
+        if (st->start_time == AV_NOPTS_VALUE) {
+            st->start_time = si.startTime;
+        }
+        if (st->duration == AV_NOPTS_VALUE) {
+            st->duration = si.duration;
+        }
+    }
+    if (pFormatCtx->duration == AV_NOPTS_VALUE) {
+        pFormatCtx->duration = entry.duration;
+    }
+    if (pFormatCtx->start_time == AV_NOPTS_VALUE) {
+        pFormatCtx->start_time = entry.startTime;
+    }
+
+    // seed the demuxer index for containers without one, so seeks don't have to scan
+    if (entry.keyframeStream >= 0 && entry.keyframeStream < static_cast<int>(pFormatCtx->nb_streams)) {
+        AVStream* st = pFormatCtx->streams[entry.keyframeStream];
+        if (avformat_index_get_entries_count(st) == 0) {
+            for (const auto& keyframe : entry.keyframes) {
+                if (keyframe.pos >= 0) {
+                    av_add_index_entry(st, keyframe.pos, keyframe.pts, 0, 0, AVINDEX_KEYFRAME);
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef VK_SDL2_VP_PROBECACHE_H
+#define VK_SDL2_VP_PROBECACHE_H
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Stream parameters found by avformat_find_stream_info, keyed by file path, size and mtime,
+// so reopening a known file can skip the probe.
+class ProbeCache {
+public:
+    struct StreamInfo {
+        int codecType = AVMEDIA_TYPE_UNKNOWN;
+        int codecId = AV_CODEC_ID_NONE;
+        uint32_t codecTag = 0;
+        int format = -1;
+        int width = 0, height = 0;
+        int sampleRate = 0;
+        int channels = 0;
+        int64_t bitRate = 0;
+        int profile = 0, level = 0;
+        AVRational timeBase{0, 1};
+        AVRational rFrameRate{0, 1};
+        AVRational avgFrameRate{0, 1};
+        AVRational sampleAspectRatio{0, 1};
+        int64_t startTime = AV_NOPTS_VALUE;
+        int64_t duration = AV_NOPTS_VALUE;
+        std::vector<uint8_t> extradata;
+    };
+
+    struct Keyframe {
+        int64_t pts;
+        int64_t pos;
+    };
+
+    struct Entry {
+        int64_t duration = AV_NOPTS_VALUE;
+        int64_t startTime = AV_NOPTS_VALUE;
+        std::vector<StreamInfo> streams;
+
+        // keyframe hints of one stream, in its time base;
+        // complete once a full scan of the stream has been done, otherwise from the demuxer index
+        int keyframeStream = -1;
+        bool keyframesComplete = false;
+        std::vector<Keyframe> keyframes;
+
+        // seconds audio and video are apart at the same file position and the mean audio packet
+        // duration, over the first seconds of the file; negative skew until measured
+        double interleaveSkew = -1.0;
+        double audioPacketDuration = 0.0;
+    };
+
+    ProbeCache() = default;
+    // files that aren't regular local files (pipes, urls) are never cached
+    explicit ProbeCache(const std::string& filename);
+
+    bool valid() const;
+
+    bool load(Entry& entry);
+    void store(const Entry& entry);
+
+    // copy probed parameters out of / back into a format context
+    static void capture(AVFormatContext* pFormatCtx, Entry& entry);
+    static bool apply(const Entry& entry, AVFormatContext* pFormatCtx);
+
+private:
+    std::filesystem::path path;
+    std::string key;
+};
+
+
+#endif //VK_SDL2_VP_PROBECACHE_H
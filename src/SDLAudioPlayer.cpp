@@ -10,12 +10,14 @@
 #include "VulkanSDL2App.h"
 
 
-SDLAudioPlayer::SDLAudioPlayer() {
+SDLAudioPlayer::SDLAudioPlayer(Uint16 samples) {
     char* name;
     SDL_GetDefaultAudioInfo(&name, &spec_, 0);
     deviceName_.assign(name);
 
-    if (spec_.samples == 0) {
+    if (samples > 0) {
+        spec_.samples = samples;
+    } else if (spec_.samples == 0) {
         spec_.samples = 1024;
     }
     spec_.userdata = this;
@@ -30,7 +32,10 @@ SDLAudioPlayer::SDLAudioPlayer() {
 }
 
 void SDLAudioPlayer::setFFmpegDecoder(FFmpegDecoder* decoder) {
+    // swapped between playlist items, not while the callback is using the old one
+    SDL_LockAudioDevice(deviceID_);
     this->ffmpegDecoder = decoder;
+    SDL_UnlockAudioDevice(deviceID_);
 }
 
 SDL_AudioSpec SDLAudioPlayer::getAudioSpec() {
@@ -68,6 +73,15 @@ void SDLAudioPlayer::updateVolume(int sign) {
 }
 
 
+bool SDLAudioPlayer::audioStarted() {
+    return audioStarted_;
+}
+
+std::chrono::steady_clock::time_point SDLAudioPlayer::getFirstAudioTime() {
+    return firstAudioTime_;
+}
+
+
 void SDLAudioPlayer::callback(void *userdata, Uint8 *stream, int len) {
     if (auto* self = static_cast<SDLAudioPlayer *>(userdata)) {
         self->fillAudio(stream, len);
@@ -77,25 +91,33 @@ void SDLAudioPlayer::callback(void *userdata, Uint8 *stream, int len) {
 void SDLAudioPlayer::fillAudio(Uint8 *stream, int len) {
     SDL_memset(stream, 0, len);
 
+    // play silence until a network stream has refilled its buffer, during an item without audio
+    // or during trick play, frame stepping and reverse play
+    if (ffmpegDecoder->isBuffering() || !ffmpegDecoder->hasAudio() || ffmpegDecoder->isTrickPlay()
+        || ffmpegDecoder->isStepping()) {
+        return;
+    }
+
     while (len > 0) {
         if (bufferSize_ == 0) {
-            if (buffer_) {
-                free(buffer_);
-                buffer_ = nullptr;
-            }
+            frame_.reset();
+            // at the end the device keeps running on silence until the next item or exit
             while (!ffmpegDecoder->audioFrameReady()) {
-                if (ffmpegDecoder->isStopped()) {
-                    stop();
+                if (ffmpegDecoder->isFinished()) {
                     return;
                 }
             }
             auto frame = ffmpegDecoder->getAudioFrame();
+            if (!audioStarted_) {
+                firstAudioTime_ = std::chrono::steady_clock::now();
+                audioStarted_ = true;
+            }
 
-            ffmpegDecoder->updateAudioClock(0, frame->audioPts);
+            ffmpegDecoder->updateAudioClock(0, frame->audioPts, frame->audioSpeed);
 
-            buffer_ = frame->audioData;
-            audioPos = buffer_;
+            audioPos = frame->audioData;
             bufferSize_ = frame->audioBufferSize;
+            frame_ = std::move(frame);
         }
 
         int fillLen = (bufferSize_ < len) ? bufferSize_ : len;
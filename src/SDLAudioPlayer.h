@@ -6,6 +6,9 @@
 #define VK_SDL2_VP_SDLAUDIOPLAYER_H
 
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <SDL2/SDL.h>
 
 #include "FFmpegDecoder.h"
@@ -13,7 +16,8 @@
 
 class SDLAudioPlayer {
 public:
-    SDLAudioPlayer();
+    // samples per device buffer, 0 for the device's default
+    explicit SDLAudioPlayer(Uint16 samples = 0);
 
     void setFFmpegDecoder(FFmpegDecoder* decoder);
 
@@ -29,6 +33,10 @@ public:
 
     void updateVolume(int sign);
 
+    // set once the first decoded samples have been handed to the device
+    bool audioStarted();
+    std::chrono::steady_clock::time_point getFirstAudioTime();
+
 private:
     FFmpegDecoder* ffmpegDecoder = nullptr;
     bool playing = false;
@@ -40,10 +48,14 @@ private:
     const int maxVolume_ = SDL_MIX_MAXVOLUME;
     int volume_ = SDL_MIX_MAXVOLUME;
 
-    Uint8 *buffer_{};
+    // frame being played, audioPos points into its PCM
+    std::shared_ptr<FFmpegDecoder::Frame> frame_;
     Uint8 *audioPos{};
     int bufferSize_{};
 
+    std::atomic<bool> audioStarted_ = false;
+    std::chrono::steady_clock::time_point firstAudioTime_;
+
 
 private:
     static void callback(void *userdata, Uint8 *stream, int len);
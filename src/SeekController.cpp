@@ -0,0 +1,37 @@
+#include "SeekController.h"
+
+void SeekController::requestRelative(double offset) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (absolute) {
+        absoluteTime += offset;
+    } else {
+        relativeOffset += offset;
+    }
+    pending_ = true;
+}
+
+void SeekController::requestAbsolute(double time) {
+    std::lock_guard<std::mutex> lock(mutex);
+    absolute = true;
+    absoluteTime = time;
+    relativeOffset = 0.0;
+    pending_ = true;
+}
+
+bool SeekController::pending() {
+    return pending_;
+}
+
+bool SeekController::take(double currentTime, double& target) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending_) {
+        return false;
+    }
+    target = absolute ? absoluteTime : currentTime + relativeOffset;
+
+    absolute = false;
+    absoluteTime = 0.0;
+    relativeOffset = 0.0;
+    pending_ = false;
+    return true;
+}
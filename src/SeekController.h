@@ -0,0 +1,31 @@
+#ifndef VK_SDL2_VP_SEEKCONTROLLER_H
+#define VK_SDL2_VP_SEEKCONTROLLER_H
+
+#include <atomic>
+#include <mutex>
+
+// Collects seek requests from the UI and merges everything requested between two executed seeks
+// into a single absolute target, so a burst of key presses costs one flush and one decode-to-target.
+class SeekController {
+public:
+    void requestRelative(double offset);
+
+    void requestAbsolute(double time);
+
+    // true while a request is waiting, in-flight work for an older target can be abandoned
+    bool pending();
+
+    // resolves the merged request against the current position and clears it
+    bool take(double currentTime, double& target);
+
+private:
+    std::mutex mutex;
+    std::atomic<bool> pending_ = false;
+
+    bool absolute = false;
+    double absoluteTime = 0.0;
+    double relativeOffset = 0.0;
+};
+
+
+#endif //VK_SDL2_VP_SEEKCONTROLLER_H
@@ -0,0 +1,200 @@
+#include "SeekPrefetcher.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// the seek keys of VulkanSDL2App::run, nearest first
+static const double PREFETCH_OFFSETS[] = {10, -10, 60, -60, 600, -600};
+
+// without a keyframe index, a cached keyframe serves seeks up to this far past it
+static const double MATCH_WINDOW = 2.0;
+
+SeekPrefetcher::SeekPrefetcher(const std::string& filename, int streamIndex, const AVCodecParameters* codecpar,
+    double duration, KeyframeIndex& keyframeIndex, size_t memoryBudget, std::function<double()> currentTime)
+    : filename(filename), streamIndex(streamIndex), duration(duration), keyframeIndex(keyframeIndex),
+      memoryBudget(memoryBudget), currentTime(std::move(currentTime)) {
+    this->codecpar = avcodec_parameters_alloc();
+    avcodec_parameters_copy(this->codecpar, codecpar);
+}
+
+SeekPrefetcher::~SeekPrefetcher() {
+    stop();
+    avcodec_parameters_free(&codecpar);
+}
+
+void SeekPrefetcher::start() {
+    running = true;
+    workerThread = std::thread(&SeekPrefetcher::worker, this);
+}
+
+void SeekPrefetcher::stop() {
+    running = false;
+    if (workerThread.joinable()) {
+        workerThread.join();
+    }
+}
+
+std::shared_ptr<FFmpegDecoder::Frame> SeekPrefetcher::lookup(double time) {
+    if (timeBase == 0.0) {
+        return nullptr;
+    }
+    // with an index, only the exact keyframe the seek will land on matches
+    int64_t keyframePts = AV_NOPTS_VALUE;
+    bool indexed = keyframeIndex.findPrior(static_cast<int64_t>(time / timeBase), keyframePts);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const Entry* best = nullptr;
+    for (const auto& entry : entries) {
+        bool match = indexed ? entry.pts == keyframePts
+                             : entry.time <= time && time - entry.time < MATCH_WINDOW;
+        if (match && (!best || entry.time > best->time)) {
+            best = &entry;
+        }
+    }
+    return best ? best->frame : nullptr;
+}
+
+void SeekPrefetcher::worker() {
+    // only use otherwise idle cpu time
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+
+    if (!open()) {
+        close();
+        return;
+    }
+
+    while (running) {
+        double now = currentTime();
+        if (!underCpuPressure()) {
+            for (double offset : PREFETCH_OFFSETS) {
+                double target = now + offset;
+                if (!running) {
+                    break;
+                }
+                if (target < 0.0 || target > duration || lookup(target)) {
+                    continue;
+                }
+                // the farther targets can't fit either, decoding them only to drop them again next round
+                if (!evict(now, std::abs(offset), frameBytes)) {
+                    break;
+                }
+                prefetch(target);
+            }
+        }
+
+        for (int i = 0; i < 50 && running; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    close();
+}
+
+bool SeekPrefetcher::open() {
+    if (avformat_open_input(&pFormatCtx, filename.data(), nullptr, nullptr)) {
+        return false;
+    }
+    if (streamIndex >= static_cast<int>(pFormatCtx->nb_streams)) {
+        return false;
+    }
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        pFormatCtx->streams[i]->discard = (static_cast<int>(i) == streamIndex) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    const AVCodec* pCodec = avcodec_find_decoder(codecpar->codec_id);
+    if (pCodec == nullptr) {
+        return false;
+    }
+    pAVCtx = avcodec_alloc_context3(pCodec);
+    avcodec_parameters_to_context(pAVCtx, codecpar);
+    // a single thread, the point is to not compete with the main pipeline
+    pAVCtx->thread_count = 1;
+    if (avcodec_open2(pAVCtx, pCodec, nullptr) < 0) {
+        return false;
+    }
+
+    timeBase = av_q2d(pFormatCtx->streams[streamIndex]->time_base);
+    frameBytes = static_cast<size_t>(av_image_get_buffer_size(AV_PIX_FMT_RGBA, codecpar->width, codecpar->height, 1)
+        + av_image_get_buffer_size(static_cast<AVPixelFormat>(codecpar->format), codecpar->width, codecpar->height, 1));
+    return true;
+}
+
+void SeekPrefetcher::close() {
+    avcodec_free_context(&pAVCtx);
+    avformat_close_input(&pFormatCtx);
+}
+
+void SeekPrefetcher::prefetch(double time) {
+    int64_t seekPts = static_cast<int64_t>(time / timeBase);
+    if (int64_t keyframePts; keyframeIndex.findPrior(seekPts, keyframePts)) {
+        seekPts = keyframePts;
+    }
+    if (av_seek_frame(pFormatCtx, streamIndex, seekPts, AVSEEK_FLAG_BACKWARD) < 0) {
+        return;
+    }
+
+    // decode the first keyframe after the landing point, then drain it out of the decoder
+    AVPacket* pAVpkt = av_packet_alloc();
+    AVFrame* pAVframe = av_frame_alloc();
+    bool gotFrame = false;
+    while (running && av_read_frame(pFormatCtx, pAVpkt) >= 0) {
+        bool isKeyframe = pAVpkt->stream_index == streamIndex && (pAVpkt->flags & AV_PKT_FLAG_KEY);
+        if (isKeyframe && avcodec_send_packet(pAVCtx, pAVpkt) >= 0 && avcodec_send_packet(pAVCtx, nullptr) >= 0) {
+            gotFrame = avcodec_receive_frame(pAVCtx, pAVframe) == 0;
+        }
+        av_packet_unref(pAVpkt);
+        if (isKeyframe) {
+            break;
+        }
+    }
+    avcodec_flush_buffers(pAVCtx);
+    av_packet_free(&pAVpkt);
+
+    if (gotFrame) {
+        // kept as decoded, only a frame that is actually shown after a seek gets converted; the source
+        // stays as well, a later seek to it may be shown at another output size
+        int64_t pts = pAVframe->best_effort_timestamp;
+        size_t bytes = static_cast<size_t>(av_image_get_buffer_size(AV_PIX_FMT_RGBA, pAVframe->width, pAVframe->height, 1)
+            + av_image_get_buffer_size(static_cast<AVPixelFormat>(pAVframe->format), pAVframe->width, pAVframe->height, 1));
+        auto frame = std::make_shared<FFmpegDecoder::Frame>();
+        frame->source = av_frame_alloc();
+        av_frame_move_ref(frame->source, pAVframe);
+        frame->videoPts = pts;
+        frame->immediate = true;
+        frame->keepSource = true;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back({pts, pts * timeBase, bytes, frame});
+        usedBytes += bytes;
+    }
+    av_frame_free(&pAVframe);
+}
+
+bool SeekPrefetcher::evict(double now, double distance, size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (usedBytes + bytes > memoryBudget) {
+        auto farthest = entries.begin();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (std::abs(it->time - now) > std::abs(farthest->time - now)) {
+                farthest = it;
+            }
+        }
+        // only ever trade a farther frame for a nearer one
+        if (farthest == entries.end() || std::abs(farthest->time - now) <= distance) {
+            return false;
+        }
+        usedBytes -= farthest->bytes;
+        entries.erase(farthest);
+    }
+    return true;
+}
+
+bool SeekPrefetcher::underCpuPressure() {
+    double load = 0.0;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    return getloadavg(&load, 1) == 1 && load > 0.75 * cores;
+}
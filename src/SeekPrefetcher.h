@@ -0,0 +1,70 @@
+#ifndef VK_SDL2_VP_SEEKPREFETCHER_H
+#define VK_SDL2_VP_SEEKPREFETCHER_H
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FFmpegDecoder.h"
+
+// Low priority worker that decodes the keyframes the seek keys would land on (current position
+// +-10 s, +-1 min, +-10 min) with its own demuxer, so a matching seek can show a frame at once
+// while the main pipeline refills. Bounded by a memory budget, idle while the machine is busy.
+class SeekPrefetcher {
+public:
+    SeekPrefetcher(const std::string& filename, int streamIndex, const AVCodecParameters* codecpar,
+                   double duration, KeyframeIndex& keyframeIndex, size_t memoryBudget,
+                   std::function<double()> currentTime);
+    ~SeekPrefetcher();
+
+    void start();
+
+    void stop();
+
+    // keyframe cached for a seek to time, nullptr if there is none
+    std::shared_ptr<FFmpegDecoder::Frame> lookup(double time);
+
+private:
+    struct Entry {
+        int64_t pts;
+        double time;
+        size_t bytes;
+        std::shared_ptr<FFmpegDecoder::Frame> frame;
+    };
+
+    std::string filename;
+    int streamIndex;
+    AVCodecParameters* codecpar;
+    double duration;
+    KeyframeIndex& keyframeIndex;
+    size_t memoryBudget;
+    std::function<double()> currentTime;
+
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    size_t usedBytes = 0;
+
+    std::atomic<bool> running = false;
+    std::thread workerThread;
+
+    AVFormatContext* pFormatCtx = nullptr;
+    AVCodecContext* pAVCtx = nullptr;
+    std::atomic<double> timeBase = 0.0;
+    // what a decoded keyframe is accounted as
+    size_t frameBytes = 0;
+
+    void worker();
+    bool open();
+    void close();
+    void prefetch(double time);
+    // drops the entries farthest from now, but not ones within distance of it, until bytes more fit
+    bool evict(double now, double distance, size_t bytes);
+    static bool underCpuPressure();
+};
+
+
+#endif //VK_SDL2_VP_SEEKPREFETCHER_H
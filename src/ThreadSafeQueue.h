@@ -8,6 +8,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <vector>
 
 template <typename T>
 class ThreadSafeQueue {
@@ -20,6 +21,10 @@ public:
         max_size_ = max_size;
     }
 
+    size_t max_size() const {
+        return max_size_;
+    }
+
     size_t size() {
         std::unique_lock<std::mutex> lock(mutex_);
         return queue_.size();
@@ -38,6 +43,9 @@ public:
 
     void clear();
 
+    // drops the oldest items until at most keep are left, they are returned for cleanup
+    std::vector<T> trim(size_t keep);
+
 private:
     std::queue<T> queue_;
     size_t max_size_ = 30;
@@ -52,7 +60,7 @@ template<typename T>
 void ThreadSafeQueue<T>::push(T item) {
     std::unique_lock<std::mutex> lock(mutex_);
     not_full_.wait(lock, [this] {return queue_.size() < max_size_;});
-    queue_.push(item);
+    queue_.push(std::move(item));
     not_empty_.notify_one();
 }
 
@@ -60,7 +68,7 @@ template<typename T>
 void ThreadSafeQueue<T>::pop(T& item) {
     std::unique_lock<std::mutex> lock(mutex_);
     not_empty_.wait(lock, [this] {return !queue_.empty();});
-    item = queue_.front();
+    item = std::move(queue_.front());
     queue_.pop();
     not_full_.notify_one();
 }
@@ -79,4 +87,16 @@ void ThreadSafeQueue<T>::clear() {
     not_full_.notify_all();
 }
 
+template<typename T>
+std::vector<T> ThreadSafeQueue<T>::trim(size_t keep) {
+    std::vector<T> dropped;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (queue_.size() > keep) {
+        dropped.push_back(std::move(queue_.front()));
+        queue_.pop();
+    }
+    not_full_.notify_all();
+    return dropped;
+}
+
 #endif //VK_SDL2_VP_THREADSAFEQUEUE_H
@@ -0,0 +1,383 @@
+#include "ThumbnailGenerator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "CacheDir.h"
+#include "ProbeCache.h"
+
+// tiles fit into a square of this size
+static const int TILE_SIZE = 160;
+static const int MAX_TILES = 200;
+static const int MAX_COLUMNS = 16;
+// shorter files get fewer tiles rather than more of the same keyframe
+static const double MIN_INTERVAL = 2.0;
+
+static const char* THUMBNAIL_CACHE_MAGIC = "vk_sdl2_vp-thumbnails";
+static const int THUMBNAIL_CACHE_VERSION = 1;
+// older atlases are dropped past this, a long file's takes about 11 MB
+static const uintmax_t THUMBNAIL_CACHE_BUDGET = 512ULL * 1024 * 1024;
+
+// ioprio_set(IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE), linux/ioprio.h isn't in every libc
+static const int IOPRIO_WHO_THREAD = 1;
+static const int IOPRIO_IDLE = 3 << 13;
+
+ThumbnailGenerator::ThumbnailGenerator(const std::string& filename, double duration, int videoWidth, int videoHeight)
+    : filename(filename), duration(duration) {
+    interval = std::max(MIN_INTERVAL, duration / MAX_TILES);
+    count = std::clamp(static_cast<int>(std::ceil(duration / interval)), 1, MAX_TILES);
+
+    // even sizes for the scaler, the aspect ratio is kept
+    if (videoWidth >= videoHeight) {
+        tileWidth = TILE_SIZE;
+        tileHeight = std::max(2, TILE_SIZE * videoHeight / std::max(1, videoWidth) & ~1);
+    } else {
+        tileHeight = TILE_SIZE;
+        tileWidth = std::max(2, TILE_SIZE * videoWidth / std::max(1, videoHeight) & ~1);
+    }
+    columns = std::min(count, MAX_COLUMNS);
+    rows = (count + columns - 1) / columns;
+
+    atlas.assign(static_cast<size_t>(columns) * tileWidth * rows * tileHeight * 4, 0);
+    placed.assign(count, 0);
+    attempted.assign(count, false);
+    tilePts.assign(count, AV_NOPTS_VALUE);
+
+    cacheKey = CacheDir::fileKey(filename);
+    if (!cacheKey.empty()) {
+        if (auto dir = CacheDir::get("thumbnails"); !dir.empty()) {
+            cachePath = dir / (CacheDir::keyName(cacheKey) + ".bin");
+        }
+    }
+}
+
+ThumbnailGenerator::~ThumbnailGenerator() {
+    stop();
+    if (workerThread.joinable()) {
+        workerThread.join();
+    }
+}
+
+void ThumbnailGenerator::start() {
+    if (running) {
+        return;
+    }
+    running = true;
+    stopped = false;
+    workerThread = std::thread(&ThumbnailGenerator::worker, this);
+}
+
+void ThumbnailGenerator::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    changed.notify_all();
+}
+
+bool ThumbnailGenerator::isStopped() const {
+    return stopped;
+}
+
+double ThumbnailGenerator::getDuration() const {
+    return duration;
+}
+
+std::array<int, 2> ThumbnailGenerator::atlasSize() const {
+    return std::array<int, 2>{columns * tileWidth, rows * tileHeight};
+}
+
+bool ThumbnailGenerator::tileAt(double time, uint64_t upTo, Tile& tile) {
+    int index = std::clamp(static_cast<int>(time / interval), 0, count - 1);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto usable = [&](int i) {
+        return placed[i] != 0 && placed[i] <= upTo;
+    };
+    // the one before first, its picture is what plays up to the position
+    int found = -1;
+    for (int distance = 0; distance < count && found < 0; ++distance) {
+        if (index - distance >= 0 && usable(index - distance)) {
+            found = index - distance;
+        } else if (index + distance < count && usable(index + distance)) {
+            found = index + distance;
+        }
+    }
+    if (placed[index] == 0 && !attempted[index] && wanted != index) {
+        wanted = index;
+        changed.notify_all();
+    }
+    if (found < 0) {
+        return false;
+    }
+    tile = {(found % columns) * tileWidth, (found / columns) * tileHeight, tileWidth, tileHeight};
+    return true;
+}
+
+uint64_t ThumbnailGenerator::revision() const {
+    return revision_;
+}
+
+void ThumbnailGenerator::copyAtlas(uint8_t* dst, size_t rowPitch) {
+    size_t atlasPitch = static_cast<size_t>(columns) * tileWidth * 4;
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int y = 0; y < rows * tileHeight; ++y) {
+        std::memcpy(dst + y * rowPitch, atlas.data() + y * atlasPitch, atlasPitch);
+    }
+}
+
+void ThumbnailGenerator::worker() {
+    // only use otherwise idle cpu and disk time, playback never waits on thumbnails
+    auto tid = static_cast<id_t>(syscall(SYS_gettid));
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_THREAD, static_cast<int>(tid), IOPRIO_IDLE);
+
+    load();
+    if (readyCount < count && open()) {
+        // coarse to fine: the ends first, then halving the step fills in between
+        int step = 1;
+        while (step * 2 < count) {
+            step *= 2;
+        }
+        std::vector<int> order;
+        for (int i = 0; i < count; i += step) {
+            order.push_back(i);
+        }
+        for (; step > 1; step /= 2) {
+            for (int i = step / 2; i < count; i += step) {
+                order.push_back(i);
+            }
+        }
+
+        size_t orderPos = 0;
+        std::vector<uint8_t> pixels(static_cast<size_t>(tileWidth) * tileHeight * 4);
+        while (running) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (running && underCpuPressure()) {
+                    changed.wait_for(lock, std::chrono::milliseconds(500));
+                }
+            }
+            int index = nextTile(order, orderPos);
+            if (index < 0) {
+                break;
+            }
+            generate(index, pixels);
+        }
+        std::printf("thumbnails: %d of %d ready\n", readyCount, count);
+    }
+    close();
+    save();
+
+    stopped = true;
+}
+
+bool ThumbnailGenerator::open() {
+    if (avformat_open_input(&pFormatCtx, filename.data(), nullptr, nullptr)) {
+        return false;
+    }
+    // the player has cached the stream parameters when it opened the file
+    ProbeCache probeCache(filename);
+    ProbeCache::Entry entry;
+    if (!(probeCache.valid() && probeCache.load(entry) && ProbeCache::apply(entry, pFormatCtx))
+        && avformat_find_stream_info(pFormatCtx, nullptr) < 0) {
+        return false;
+    }
+
+    streamIndex = av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIndex < 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < pFormatCtx->nb_streams; ++i) {
+        pFormatCtx->streams[i]->discard = (static_cast<int>(i) == streamIndex) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    const AVCodecParameters* codecpar = pFormatCtx->streams[streamIndex]->codecpar;
+    const AVCodec* pCodec = avcodec_find_decoder(codecpar->codec_id);
+    if (pCodec == nullptr) {
+        return false;
+    }
+    pAVCtx = avcodec_alloc_context3(pCodec);
+    avcodec_parameters_to_context(pAVCtx, codecpar);
+    // a single thread, keyframes only, at the smallest resolution still covering a tile
+    pAVCtx->thread_count = 1;
+    pAVCtx->skip_frame = AVDISCARD_NONKEY;
+    pAVCtx->skip_loop_filter = AVDISCARD_ALL;
+    int lowres = 0;
+    while (lowres < pCodec->max_lowres
+        && (codecpar->width >> (lowres + 1)) >= tileWidth && (codecpar->height >> (lowres + 1)) >= tileHeight) {
+        lowres++;
+    }
+    pAVCtx->lowres = lowres;
+    return avcodec_open2(pAVCtx, pCodec, nullptr) >= 0;
+}
+
+void ThumbnailGenerator::close() {
+    sws_freeContext(swsCtx);
+    swsCtx = nullptr;
+    avcodec_free_context(&pAVCtx);
+    avformat_close_input(&pFormatCtx);
+}
+
+int ThumbnailGenerator::nextTile(const std::vector<int>& order, size_t& orderPos) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // a position hovered over goes before the rest
+    int index = wanted;
+    wanted = -1;
+    if (index < 0 || attempted[index]) {
+        index = -1;
+        while (index < 0 && orderPos < order.size()) {
+            int candidate = order[orderPos++];
+            if (!attempted[candidate]) {
+                index = candidate;
+            }
+        }
+    }
+    if (index >= 0) {
+        attempted[index] = true;
+    }
+    return index;
+}
+
+bool ThumbnailGenerator::generate(int index, std::vector<uint8_t>& pixels) {
+    AVStream* stream = pFormatCtx->streams[streamIndex];
+    int64_t startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t target = startPts + static_cast<int64_t>(index * interval / av_q2d(stream->time_base));
+    if (av_seek_frame(pFormatCtx, streamIndex, target, AVSEEK_FLAG_BACKWARD) < 0) {
+        return false;
+    }
+
+    // the keyframe at or before the position, drained out of the decoder right away
+    AVPacket* pAVpkt = av_packet_alloc();
+    AVFrame* pAVframe = av_frame_alloc();
+    int64_t pts = AV_NOPTS_VALUE;
+    int sameAs = -1;
+    bool gotFrame = false;
+    while (running && av_read_frame(pFormatCtx, pAVpkt) >= 0) {
+        bool isKeyframe = pAVpkt->stream_index == streamIndex && (pAVpkt->flags & AV_PKT_FLAG_KEY);
+        if (isKeyframe) {
+            pts = pAVpkt->pts != AV_NOPTS_VALUE ? pAVpkt->pts : pAVpkt->dts;
+            // with GOPs longer than the interval, neighbouring positions land on the same keyframe
+            auto done = std::find(tilePts.begin(), tilePts.end(), pts);
+            if (pts != AV_NOPTS_VALUE && done != tilePts.end()) {
+                sameAs = static_cast<int>(done - tilePts.begin());
+            } else if (avcodec_send_packet(pAVCtx, pAVpkt) >= 0 && avcodec_send_packet(pAVCtx, nullptr) >= 0) {
+                gotFrame = avcodec_receive_frame(pAVCtx, pAVframe) == 0;
+            }
+        }
+        av_packet_unref(pAVpkt);
+        if (isKeyframe) {
+            break;
+        }
+    }
+    avcodec_flush_buffers(pAVCtx);
+    av_packet_free(&pAVpkt);
+
+    bool placed = false;
+    size_t atlasPitch = static_cast<size_t>(columns) * tileWidth * 4;
+    size_t tilePitch = static_cast<size_t>(tileWidth) * 4;
+    if (sameAs >= 0) {
+        // only this thread writes the atlas, reading it needs no lock
+        const uint8_t* src = atlas.data() + static_cast<size_t>(sameAs / columns) * tileHeight * atlasPitch
+            + static_cast<size_t>(sameAs % columns) * tilePitch;
+        for (int y = 0; y < tileHeight; ++y) {
+            std::memcpy(pixels.data() + y * tilePitch, src + y * atlasPitch, tilePitch);
+        }
+        placed = true;
+    } else if (gotFrame) {
+        swsCtx = sws_getCachedContext(swsCtx, pAVframe->width, pAVframe->height,
+            static_cast<AVPixelFormat>(pAVframe->format), tileWidth, tileHeight, AV_PIX_FMT_RGBA,
+            SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if (swsCtx) {
+            uint8_t* dst[4] = {pixels.data(), nullptr, nullptr, nullptr};
+            int dstStride[4] = {static_cast<int>(tilePitch), 0, 0, 0};
+            sws_scale(swsCtx, pAVframe->data, pAVframe->linesize, 0, pAVframe->height, dst, dstStride);
+            placed = true;
+        }
+    }
+    av_frame_free(&pAVframe);
+
+    if (placed) {
+        place(index, pixels.data(), pts);
+    }
+    return placed;
+}
+
+void ThumbnailGenerator::place(int index, const uint8_t* pixels, int64_t pts) {
+    size_t atlasPitch = static_cast<size_t>(columns) * tileWidth * 4;
+    size_t tilePitch = static_cast<size_t>(tileWidth) * 4;
+    uint8_t* dst = atlas.data() + static_cast<size_t>(index / columns) * tileHeight * atlasPitch
+        + static_cast<size_t>(index % columns) * tilePitch;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int y = 0; y < tileHeight; ++y) {
+        std::memcpy(dst + y * atlasPitch, pixels + y * tilePitch, tilePitch);
+    }
+    tilePts[index] = pts;
+    if (placed[index] == 0) {
+        readyCount++;
+    }
+    placed[index] = ++revision_;
+}
+
+std::string ThumbnailGenerator::cacheHeader() const {
+    char geometry[128];
+    std::snprintf(geometry, sizeof(geometry), "%d %d %d %d %.6f\n", tileWidth, tileHeight, columns, count, interval);
+    return std::string(THUMBNAIL_CACHE_MAGIC) + " " + std::to_string(THUMBNAIL_CACHE_VERSION) + "\n"
+        + "key " + cacheKey + "\n" + geometry;
+}
+
+void ThumbnailGenerator::load() {
+    std::vector<char> data;
+    if (cachePath.empty() || !CacheDir::readFile(cachePath, data)) {
+        return;
+    }
+    // header, a ready flag per tile, then the atlas; a hash collision or a truncated file is redone
+    std::string header = cacheHeader();
+    if (data.size() != header.size() + count + atlas.size()
+        || std::memcmp(data.data(), header.data(), header.size()) != 0) {
+        return;
+    }
+    const char* flags = data.data() + header.size();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::memcpy(atlas.data(), flags + count, atlas.size());
+    revision_++;
+    for (int i = 0; i < count; ++i) {
+        if (flags[i]) {
+            placed[i] = revision_;
+            attempted[i] = true;
+            readyCount++;
+        }
+    }
+    savedCount = readyCount;
+}
+
+void ThumbnailGenerator::save() {
+    // called by the worker, the only thread writing the atlas and the flags
+    if (cachePath.empty() || readyCount == savedCount) {
+        return;
+    }
+    std::string data = cacheHeader();
+    for (int i = 0; i < count; ++i) {
+        data.push_back(placed[i] != 0 ? 1 : 0);
+    }
+    data.append(reinterpret_cast<const char*>(atlas.data()), atlas.size());
+    if (CacheDir::writeFile(cachePath, data.data(), data.size())) {
+        savedCount = readyCount;
+        CacheDir::trim(cachePath.parent_path(), THUMBNAIL_CACHE_BUDGET);
+    }
+}
+
+bool ThumbnailGenerator::underCpuPressure() {
+    double load = 0.0;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    return getloadavg(&load, 1) == 1 && load > 0.75 * cores;
+}
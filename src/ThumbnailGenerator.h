@@ -0,0 +1,109 @@
+#ifndef VK_SDL2_VP_THUMBNAILGENERATOR_H
+#define VK_SDL2_VP_THUMBNAILGENERATOR_H
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Scrub preview thumbnails of a local file: a low priority worker with its own demuxer decodes the
+// keyframe at regular intervals at a reduced resolution and packs it into an RGBA atlas, coarse to
+// fine so the whole timeline is covered early. Only idle cpu and disk time is used. Finished tiles
+// are cached on disk by file identity, a file opened again has its thumbnails at once.
+class ThumbnailGenerator {
+public:
+    struct Tile {
+        // in atlas pixels
+        int x, y;
+        int width, height;
+    };
+
+    ThumbnailGenerator(const std::string& filename, double duration, int videoWidth, int videoHeight);
+    ~ThumbnailGenerator();
+
+    ThumbnailGenerator(const ThumbnailGenerator&) = delete;
+    ThumbnailGenerator& operator=(const ThumbnailGenerator&) = delete;
+
+    void start();
+
+    // doesn't wait for the worker, isStopped tells when it is gone
+    void stop();
+
+    bool isStopped() const;
+
+    double getDuration() const;
+
+    std::array<int, 2> atlasSize() const;
+
+    // thumbnail for a position among the tiles added up to revision upTo, the ones in a copy of the
+    // atlas taken then; the closest one if its own isn't there, which is then made next
+    bool tileAt(double time, uint64_t upTo, Tile& tile);
+
+    // goes up whenever tiles are added to the atlas
+    uint64_t revision() const;
+
+    // copies the atlas into rows rowPitch bytes apart, it has at least the tiles up to revision()
+    // as read before
+    void copyAtlas(uint8_t* dst, size_t rowPitch);
+
+private:
+    std::string filename;
+    double duration;
+    double interval;
+    int tileWidth, tileHeight;
+    int columns, rows;
+    int count;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<uint8_t> atlas;
+    // revision each tile was added at, 0 while it isn't
+    std::vector<uint64_t> placed;
+    // taken by the worker once, a position it couldn't decode isn't tried again
+    std::vector<bool> attempted;
+    int readyCount = 0;
+    int wanted = -1;
+    std::atomic<uint64_t> revision_ = 0;
+
+    std::atomic<bool> running = false;
+    std::atomic<bool> stopped = true;
+    std::thread workerThread;
+
+    // keyframe shown by each tile, a keyframe serving several tiles is decoded once
+    std::vector<int64_t> tilePts;
+
+    std::filesystem::path cachePath;
+    std::string cacheKey;
+    int savedCount = 0;
+
+    AVFormatContext* pFormatCtx = nullptr;
+    AVCodecContext* pAVCtx = nullptr;
+    SwsContext* swsCtx = nullptr;
+    int streamIndex = -1;
+
+    void worker();
+    bool open();
+    void close();
+    int nextTile(const std::vector<int>& order, size_t& orderPos);
+    bool generate(int index, std::vector<uint8_t>& pixels);
+    void place(int index, const uint8_t* pixels, int64_t pts);
+
+    std::string cacheHeader() const;
+    void load();
+    void save();
+
+    static bool underCpuPressure();
+};
+
+
+#endif //VK_SDL2_VP_THUMBNAILGENERATOR_H
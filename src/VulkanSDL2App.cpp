@@ -1,6 +1,12 @@
 #include "VulkanSDL2App.h"
+
 #include <iostream>
 #include <set>
+#include <future>
+#include <numeric>
+#include <cmath>
+
+#include "CacheDir.h"
 
 #include "../shaders/vert_spv.h"
 #include "../shaders/frag_spv.h"
@@ -49,8 +55,31 @@ VulkanSDL2App::VulkanSDL2App(std::string title, int width, int height, Config co
     this->windowHeight = height;
     this->config = config;
 
+    startupBegin = std::chrono::steady_clock::now();
+    auto elapsedMs = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    };
+
     initWindow();
-    initVulkan();
+
+    // opening the audio device and probing the media don't depend on vulkan,
+    // so they run while the instance, device and pipeline are being created
+    auto mediaReady = std::async(std::launch::async, [this, elapsedMs] {
+        auto begin = std::chrono::steady_clock::now();
+        initMedia();
+        startupTimes.media = elapsedMs(begin);
+    });
+
+    auto vulkanBegin = std::chrono::steady_clock::now();
+    initVulkanDevice();
+    startupTimes.vulkan = elapsedMs(vulkanBegin);
+
+    // the window size and swapchain depend on the media dimensions
+    mediaReady.get();
+    resizeWindowToMedia();
+    initVulkanSwapChain();
+
+    startupTimes.total = elapsedMs(startupBegin);
 }
 
 VulkanSDL2App::~VulkanSDL2App() {
@@ -66,6 +95,8 @@ void VulkanSDL2App::run() {
         audioPlayer->run();
     }
     ffmpegDecoder->run();
+    preloadNextItem();
+    createThumbnails();
 
     printAppInfos();
 
@@ -75,6 +106,7 @@ void VulkanSDL2App::run() {
 
     while (running) {
         while (SDL_PollEvent(&event)) {
+            std::lock_guard<std::mutex> lock(decoderMutex);
             if (event.type == SDL_QUIT) {
                 running = false;
                 break;
@@ -117,6 +149,47 @@ void VulkanSDL2App::run() {
                         case SDLK_PAGEDOWN:
                             ffmpegDecoder->seekTime(-600);
                             break;
+                        case SDLK_LEFTBRACKET:
+                            ffmpegDecoder->setLoopStart();
+                            break;
+                        case SDLK_RIGHTBRACKET:
+                            ffmpegDecoder->setLoopEnd();
+                            break;
+                        case SDLK_BACKSLASH:
+                            ffmpegDecoder->clearLoop();
+                            break;
+                        case SDLK_l: {
+                            int rate = ffmpegDecoder->getTrickRate();
+                            ffmpegDecoder->setTrickRate(rate >= 2 ? rate * 2 : 2);
+                            break;
+                        }
+                        case SDLK_j: {
+                            int rate = ffmpegDecoder->getTrickRate();
+                            ffmpegDecoder->setTrickRate(rate <= -2 ? rate * 2 : -2);
+                            break;
+                        }
+                        case SDLK_k:
+                            ffmpegDecoder->setTrickRate(1);
+                            ffmpegDecoder->resumePlayback();
+                            break;
+                        case SDLK_PERIOD:
+                            ffmpegDecoder->stepFrame(1);
+                            break;
+                        case SDLK_COMMA:
+                            ffmpegDecoder->stepFrame(-1);
+                            break;
+                        case SDLK_b:
+                            ffmpegDecoder->toggleReverse();
+                            break;
+                        case SDLK_MINUS:
+                            updateSpeed(-1);
+                            break;
+                        case SDLK_EQUALS:
+                            updateSpeed(1);
+                            break;
+                        case SDLK_0:
+                            updateSpeed(0);
+                            break;
                         default:
                             break;
                     }
@@ -136,10 +209,12 @@ void VulkanSDL2App::run() {
                     }
                     if (event.button.button == SDL_BUTTON_RIGHT) {
                         int x = event.button.x;
-                        double seekTime = (double)x / windowWidth * ffmpegDecoder->getDuration() - ffmpegDecoder->getRelativeTime();
-                        ffmpegDecoder->seekTime(seekTime);
+                        ffmpegDecoder->seekTo((double)x / windowWidth * ffmpegDecoder->getDuration());
                     }
                     break;
+                case SDL_MOUSEMOTION:
+                    hoverScrubBar(event.motion.x, event.motion.y);
+                    break;
                 case SDL_WINDOWEVENT:
                     switch (event.window.event) {
                         case SDL_WINDOWEVENT_SIZE_CHANGED:
@@ -149,6 +224,9 @@ void VulkanSDL2App::run() {
                                 frameBufferResized = true;
                             }
 
+                            break;
+                        case SDL_WINDOWEVENT_LEAVE:
+                            hoverScrubBar(-1, -1);
                             break;
                         default:
                             break;
@@ -160,18 +238,37 @@ void VulkanSDL2App::run() {
                 break;
             }
         }
+        reportTimeToFirstAudio();
         // Avoid high cpu usage on the main thread
         std::this_thread::sleep_for(std::chrono::milliseconds(5));
     }
 
-    ffmpegDecoder->stop();
-    while (!ffmpegDecoder->isStopped()) {}
+    // running is false, so the draw thread doesn't switch to another item past this point
+    FFmpegDecoder* decoder;
+    {
+        std::lock_guard<std::mutex> lock(decoderMutex);
+        decoder = ffmpegDecoder;
+        decoder->stop();
+    }
+    while (!decoder->isStopped()) {}
 
     audioPlayer->stop();
 
     drawThreadRunning = false;
     while (!drawThreadExited) {}
 
+    if (nextItem.valid()) {
+        if (PreloadedItem item = nextItem.get(); item.decoder) {
+            retiredDecoders.push_back(item.decoder);
+        }
+    }
+    if (thumbnails) {
+        thumbnails->stop();
+        retiredThumbnails.push_back(thumbnails);
+        thumbnails = nullptr;
+    }
+    releaseRetiredDecoders(true);
+
 
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -180,45 +277,113 @@ void VulkanSDL2App::run() {
 }
 
 void VulkanSDL2App::draw() {
-    double dt = ffmpegDecoder->getDeltaTime();
-    if (ffmpegDecoder->isVideo() && ffmpegDecoder->hasAudio()) {
-        while (drawThreadRunning) {
-            if (ffmpegDecoder->isStopped()) {
-                break;
-            }
-            auto frame = ffmpegDecoder->getVideoFrame();
-            if (!frame->data) {
-                continue;
+    bool firstFrame = true;
+    auto presentFrame = [this, &firstFrame](std::shared_ptr<FFmpegDecoder::Frame> frame) {
+        // frames are converted to RGBA only once it is certain they are shown
+        if (!ffmpegDecoder->convertFrame(*frame)) {
+            return;
+        }
+        DrawFrame(std::move(frame));
+        if (firstFrame) {
+            firstFrame = false;
+            std::printf("time to first frame: %.1lf ms\n",
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count());
+            // not before, so it doesn't compete with startup
+            if (thumbnails) {
+                thumbnails->start();
             }
+        }
+    };
 
-            long long sleepTime = ffmpegDecoder->getDelay(frame->videoPts) * 1000000;
-            if (sleepTime >= 0) {
-                if (sleepTime > 500000) {
-                    sleepTime = static_cast<long long>(dt * 1000000);
+    // one pass per playlist item, the swap keeps the swapchain, textures and audio device
+    do {
+        double dt = ffmpegDecoder->getDeltaTime();
+        // prefetched seek, stepped and trick play frames are shown once, right away, whatever the clock says
+        std::shared_ptr<FFmpegDecoder::Frame> lastImmediate;
+        auto presentImmediate = [this, &lastImmediate, &presentFrame, dt](const std::shared_ptr<FFmpegDecoder::Frame>& frame) {
+            if (frame != lastImmediate) {
+                lastImmediate = frame;
+                presentFrame(frame);
+            } else {
+                // a still is presented once, again only for a change of the scrub preview over it
+                if (scrubPreviewChanged()) {
+                    DrawFrame(frame);
                 }
-                std::this_thread::sleep_for(std::chrono::microseconds(sleepTime));
-            } else if (sleepTime < -100000) {
-                continue;
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(dt * 1000000)));
             }
+        };
 
-            DrawFrame(frame);
-        }
-    } else {
-        while (drawThreadRunning) {
-            if (ffmpegDecoder->isStopped()) {
-                break;
+        if (ffmpegDecoder->isVideo() && ffmpegDecoder->hasAudio()) {
+            while (drawThreadRunning) {
+                if (ffmpegDecoder->isFinished()) {
+                    break;
+                }
+                // hold the current picture while a network stream rebuffers
+                if (ffmpegDecoder->isBuffering()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+                auto frame = ffmpegDecoder->getVideoFrame();
+                if (!frame->hasVideo()) {
+                    continue;
+                }
+
+                // the audio clock hasn't started yet, show the first keyframe as soon as it is decoded
+                if (firstFrame && config.fastStart) {
+                    presentFrame(frame);
+                    continue;
+                }
+
+                if (frame->immediate) {
+                    presentImmediate(frame);
+                    continue;
+                }
+
+                // the clock runs at the playback speed, the delay is in media seconds
+                double delay = ffmpegDecoder->getDelay(frame->videoPts) / ffmpegDecoder->getSpeed();
+                ffmpegDecoder->reportLateness(-delay);
+                long long sleepTime = delay * 1000000;
+                if (sleepTime >= 0) {
+                    if (sleepTime > 500000) {
+                        sleepTime = static_cast<long long>(dt * 1000000);
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(sleepTime));
+                } else if (sleepTime < -100000) {
+                    continue;
+                }
+
+                presentFrame(frame);
+                lastImmediate.reset();
             }
-            auto t1 = std::chrono::high_resolution_clock::now();
-            auto frame = ffmpegDecoder->getVideoFrame();
-            if (!frame->data) {
-                continue;
+        } else {
+            while (drawThreadRunning) {
+                if (ffmpegDecoder->isFinished()) {
+                    break;
+                }
+                // hold the current picture while a network stream rebuffers
+                if (ffmpegDecoder->isBuffering()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+                auto t1 = std::chrono::high_resolution_clock::now();
+                auto frame = ffmpegDecoder->getVideoFrame();
+                if (!frame->hasVideo()) {
+                    continue;
+                }
+                if (frame->immediate) {
+                    presentImmediate(frame);
+                    continue;
+                }
+                presentFrame(frame);
+                lastImmediate.reset();
+                auto t2 = std::chrono::high_resolution_clock::now();
+                long long sleepTime = static_cast<long long>(dt / ffmpegDecoder->getSpeed() * 1000000) -  std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+                // waiting on the decoder for longer than a frame interval means it can't keep up
+                ffmpegDecoder->reportLateness(-sleepTime / 1000000.0);
+                std::this_thread::sleep_for(std::chrono::microseconds(sleepTime < 0 ? 0 : sleepTime));
             }
-            DrawFrame(frame);
-            auto t2 = std::chrono::high_resolution_clock::now();
-            long long sleepTime = static_cast<long long>(dt * 1000000) -  std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
-            std::this_thread::sleep_for(std::chrono::microseconds(sleepTime < 0 ? 0 : sleepTime));
         }
-    }
+    } while (running && drawThreadRunning && advancePlaylist());
 
     graphicsQueue.waitIdle();
     presentQueue.waitIdle();
@@ -234,16 +399,184 @@ void VulkanSDL2App::initWindow() {
         throw std::runtime_error(error);
     }
 
-    audioPlayer = new SDLAudioPlayer();
-    auto spec = audioPlayer->getAudioSpec();
-    ffmpegDecoder = new FFmpegDecoder(this->title, spec, config.autoReplay);
-    audioPlayer->setFFmpegDecoder(ffmpegDecoder);
-
     if (SDL_GetNumVideoDisplays() < 0) {
         auto error = "No available displays: " + std::string(SDL_GetError());
         throw std::runtime_error(error);
     }
 
+    // hidden until the media size is known, the surface is needed for device selection before that
+    window = SDL_CreateWindow(
+        title.data(),
+        0, 0, windowWidth, windowHeight,
+        SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_HIDDEN);
+
+    if (window == nullptr) {
+        auto error = "Create window failed: " + std::string(SDL_GetError());
+        throw std::runtime_error(error);
+    }
+
+    // the video is never shown larger than the display, even in fullscreen
+    if (SDL_DisplayMode mode; SDL_GetDesktopDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0) {
+        displayWidth = mode.w;
+        displayHeight = mode.h;
+    }
+}
+
+void VulkanSDL2App::initMedia() {
+    // a shorter device buffer takes a few ms off the audio path of live input
+    bool live = config.live || FFmpegDecoder::isLiveSource(title);
+    audioPlayer = new SDLAudioPlayer(live ? 256 : 0);
+    audioSpec = audioPlayer->getAudioSpec();
+    ffmpegDecoder = new FFmpegDecoder(this->title, audioSpec, makeDecoderConfig(title, true));
+    audioPlayer->setFFmpegDecoder(ffmpegDecoder);
+}
+
+DecoderConfig VulkanSDL2App::makeDecoderConfig(const std::string& filename, bool firstItem) {
+    DecoderConfig decoderConfig;
+    // with several items -r loops the playlist, not each file
+    decoderConfig.replay = config.autoReplay && config.playlist.size() < 2;
+    // -ss is where the first item starts, the following ones and later rounds start at their beginning
+    decoderConfig.startTime = firstItem ? config.startTime : 0.0;
+    decoderConfig.probeSize = config.probeSize;
+    decoderConfig.analyzeDuration = config.analyzeDuration;
+    decoderConfig.probeCache = config.probeCache;
+    decoderConfig.prefetchBudget = config.prefetchBudget;
+    decoderConfig.maxOutputWidth = displayWidth;
+    decoderConfig.maxOutputHeight = displayHeight;
+    decoderConfig.ioBackend = config.ioBackend;
+    decoderConfig.readAheadWindow = config.readAheadWindow;
+    decoderConfig.demuxMode = config.demuxMode;
+    decoderConfig.bufferLow = config.bufferLow;
+    decoderConfig.bufferHigh = config.bufferHigh;
+    decoderConfig.live = config.live || FFmpegDecoder::isLiveSource(filename);
+    decoderConfig.maxLatency = config.maxLatency;
+    decoderConfig.loopCacheBudget = config.loopCacheBudget;
+    decoderConfig.gopCacheBudget = config.gopCacheBudget;
+    decoderConfig.speed = config.speed;
+    return decoderConfig;
+}
+
+void VulkanSDL2App::preloadNextItem() {
+    if (config.playlist.size() < 2) {
+        return;
+    }
+    nextItem = std::async(std::launch::async, [this] {
+        // items that fail to open are skipped, at most one round through the list
+        for (size_t step = 1; step <= config.playlist.size(); ++step) {
+            size_t index = (playlistIndex + step) % config.playlist.size();
+            if (index <= playlistIndex && !config.autoReplay) {
+                break;
+            }
+            const std::string& filename = config.playlist[index];
+            try {
+                // running it fills the frame queues, so the first frames are ready at the switch
+                auto* decoder = new FFmpegDecoder(filename, audioSpec, makeDecoderConfig(filename, false));
+                decoder->run();
+                return PreloadedItem{decoder, index};
+            } catch (const std::exception& e) {
+                std::printf("skipping %s: %s\n", filename.c_str(), e.what());
+            }
+        }
+        return PreloadedItem{};
+    });
+}
+
+bool VulkanSDL2App::advancePlaylist() {
+    if (!nextItem.valid()) {
+        return false;
+    }
+    PreloadedItem item = nextItem.get();
+    if (!item.decoder) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(decoderMutex);
+        if (!running) {
+            item.decoder->stop();
+            retiredDecoders.push_back(item.decoder);
+            return false;
+        }
+        retiredDecoders.push_back(ffmpegDecoder);
+        ffmpegDecoder = item.decoder;
+        // preloaded before the speed may have changed
+        ffmpegDecoder->setSpeed(config.speed);
+        audioPlayer->setFFmpegDecoder(ffmpegDecoder);
+        playlistIndex = item.index;
+    }
+    if (ffmpegDecoder->hasAudio()) {
+        audioPlayer->run();
+    }
+    std::printf("playing %zu/%zu: %s\n", playlistIndex + 1, config.playlist.size(), config.playlist[playlistIndex].c_str());
+
+    createThumbnails();
+    if (thumbnails) {
+        thumbnails->start();
+    }
+
+    // the textures are reallocated by updateTexture only if the new item has another size
+    auto mediaSize = ffmpegDecoder->getVideoSize();
+    if (mediaSize[0] != mediaWidth || mediaSize[1] != mediaHeight) {
+        mediaWidth = mediaSize[0];
+        mediaHeight = mediaSize[1];
+        updateViewport();
+    }
+
+    releaseRetiredDecoders(false);
+    preloadNextItem();
+    return true;
+}
+
+void VulkanSDL2App::releaseRetiredDecoders(bool wait) {
+    std::lock_guard<std::mutex> lock(decoderMutex);
+    for (auto it = retiredDecoders.begin(); it != retiredDecoders.end();) {
+        FFmpegDecoder* decoder = *it;
+        if (wait) {
+            decoder->stop();
+            while (!decoder->isStopped()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        if (decoder->isStopped()) {
+            delete decoder;
+            it = retiredDecoders.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // thumbnail generators of earlier items, deleting one joins its worker
+    for (auto it = retiredThumbnails.begin(); it != retiredThumbnails.end();) {
+        if (wait || (*it)->isStopped()) {
+            delete *it;
+            it = retiredThumbnails.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void VulkanSDL2App::createThumbnails() {
+    if (thumbnails) {
+        thumbnails->stop();
+        retiredThumbnails.push_back(thumbnails);
+        thumbnails = nullptr;
+    }
+    // what is on the gpu belongs to the previous item
+    thumbnailRevision = 0;
+
+    // local files only, a network source would pay for every thumbnail in bandwidth
+    const std::string& filename = config.playlist[playlistIndex];
+    double duration = ffmpegDecoder->getDuration();
+    auto size = ffmpegDecoder->getVideoSize();
+    std::error_code ec;
+    if (!config.thumbnails || !ffmpegDecoder->isVideo() || duration <= 0.0 || size[0] <= 0 || size[1] <= 0
+        || !std::filesystem::is_regular_file(filename, ec)) {
+        return;
+    }
+    thumbnails = new ThumbnailGenerator(filename, duration, size[0], size[1]);
+}
+
+void VulkanSDL2App::resizeWindowToMedia() {
     SDL_DisplayMode displayMode;
     SDL_GetDesktopDisplayMode(0, &displayMode);
 
@@ -270,16 +603,8 @@ void VulkanSDL2App::initWindow() {
         windowWidth =  (double) windowHeight * aspectRatioMedia;
     }
 
-
-    window = SDL_CreateWindow(
-        title.data(),
-        0, 0, windowWidth, windowHeight,
-        SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-
-    if (window == nullptr) {
-        auto error = "Create window failed: " + std::string(SDL_GetError());
-        throw std::runtime_error(error);
-    }
+    SDL_SetWindowSize(window, windowWidth, windowHeight);
+    SDL_ShowWindow(window);
 }
 
 void VulkanSDL2App::printAppInfos() {
@@ -301,6 +626,8 @@ void VulkanSDL2App::printAppInfos() {
         );
     std::printf("Selected GPU:      %s\n", physicalDeviceName.c_str());
     std::printf("Audio device:      %s\n", audioPlayer->getDeviceName().c_str());
+    std::printf("startup:           %.1lf ms (media %.1lf ms, vulkan %.1lf ms in parallel)\n",
+        startupTimes.total, startupTimes.media, startupTimes.vulkan);
     std::printf("\nWhile playing:\n"
         "q, ESC             quit\n"
         "f                  toggle full screen\n"
@@ -309,17 +636,39 @@ void VulkanSDL2App::printAppInfos() {
         "left/right         seek backward/forward 10 seconds\n"
         "a/d                seek backward/forward 1 minute\n"
         "page down/page up  seek backward/forward 10 minutes\n"
+        "[ / ]              set the A-B loop start, then its end to start looping\n"
+        "\\                  stop looping\n"
+        "j/l                rewind/fast forward, pressing again doubles the rate up to 64x\n"
+        "k                  back to normal playback\n"
+        ", / .              step one frame back/forward, p or SPC plays on\n"
+        "b                  toggle reverse play\n"
+        "-/=                decrease and increase playback speed, 0 back to normal speed\n"
         "right mouse click  seek to percentage in file corresponding to fraction of width\n"
+        "mouse at bottom    preview the position a right click there seeks to\n"
         "left double-click  toggle full screen\n\n"
         );
 }
 
+void VulkanSDL2App::reportTimeToFirstAudio() {
+    static bool reported = false;
+    if (!reported && audioPlayer->audioStarted()) {
+        reported = true;
+        std::printf("time to first audio: %.1lf ms\n",
+            std::chrono::duration<double, std::milli>(audioPlayer->getFirstAudioTime() - startupBegin).count());
+    }
+}
+
 void VulkanSDL2App::toggleFullscreen() {
     SDL_SetWindowFullscreen(window, isFullscreen ? 0 : SDL_WINDOW_FULLSCREEN_DESKTOP);
     isFullscreen = !isFullscreen;
 }
 
 void VulkanSDL2App::togglePause() {
+    // stepping holds the picture already, play goes back to normal playback
+    if (ffmpegDecoder->isStepping()) {
+        ffmpegDecoder->resumePlayback();
+        return;
+    }
     ffmpegDecoder->pause();
 }
 
@@ -327,11 +676,50 @@ void VulkanSDL2App::updateVolume(int sign) {
     audioPlayer->updateVolume(sign);
 }
 
+void VulkanSDL2App::updateSpeed(int sign) {
+    static const double SPEEDS[] = {0.25, 0.5, 0.75, 1.0, 1.25, 1.5, 1.75, 2.0, 2.5, 3.0, 4.0};
+    static const int COUNT = sizeof(SPEEDS) / sizeof(SPEEDS[0]);
+    if (sign == 0) {
+        config.speed = 1.0;
+    } else {
+        // the closest step, -speed may have been given between two
+        int index = 0;
+        for (int i = 1; i < COUNT; ++i) {
+            if (std::abs(SPEEDS[i] - config.speed) < std::abs(SPEEDS[index] - config.speed)) {
+                index = i;
+            }
+        }
+        config.speed = SPEEDS[std::clamp(index + sign, 0, COUNT - 1)];
+    }
+    ffmpegDecoder->setSpeed(config.speed);
+}
+
+void VulkanSDL2App::hoverScrubBar(int x, int y) {
+    // the bottom eighth of the window
+    double position = -1.0;
+    if (x >= 0 && y >= windowHeight - windowHeight / 8) {
+        position = std::clamp(static_cast<double>(x) / windowWidth, 0.0, 1.0);
+    }
+    if (position != scrubPreview.position) {
+        scrubPreview.position = position;
+        scrubPreview.changed = true;
+    }
+}
+
+bool VulkanSDL2App::scrubPreviewChanged() {
+    // or a thumbnail came in while hovering
+    return scrubPreview.changed
+        || (thumbnails && scrubPreview.position >= 0.0 && thumbnails->revision() != thumbnailRevision);
+}
+
 void VulkanSDL2App::destroyVulkan() {
     cleanupSwapChain();
 
     device.destroyPipeline(graphicsPipeline);
 
+    savePipelineCache();
+    device.destroyPipelineCache(pipelineCache);
+
     device.destroyPipelineLayout(graphicsPipelineLayout);
 
     device.destroyDescriptorPool(graphicsDescriptorPool);
@@ -347,10 +735,15 @@ void VulkanSDL2App::destroyVulkan() {
     device.destroyRenderPass(renderPass);
 
     textures = std::vector<Texture>();
+    thumbnailAtlas.reset();
 
     device.destroyBuffer(vertexBuffer);
     device.freeMemory(vertexBufferMemory);
 
+    device.unmapMemory(previewVertexMemory);
+    device.destroyBuffer(previewVertexBuffer);
+    device.freeMemory(previewVertexMemory);
+
     device.freeCommandBuffers(commandPool, commandBuffers.size(), commandBuffers.data());
     device.destroyCommandPool(commandPool);
 
@@ -363,23 +756,29 @@ void VulkanSDL2App::destroyVulkan() {
     instance.destroy();
 }
 
-void VulkanSDL2App::initVulkan() {
+void VulkanSDL2App::initVulkanDevice() {
     createInstance();
     createSurface();
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
-    createImageViews();
     createRenderPass();
-    createFrameBuffers();
     createGraphicsDescriptorSetLayout();
+    createPipelineCache();
     createGraphicsPipeline();
     createCommandPool();
-    createCommandBuffers();
     createVertexBuffer();
+}
+
+void VulkanSDL2App::initVulkanSwapChain() {
+    createSwapChain();
+    updateViewport();
+    createImageViews();
+    createFrameBuffers();
+    createCommandBuffers();
     createDescriptorPool();
     createDescriptorSets();
     initTextureResource();
+    createThumbnailResources();
     createSyncObjects();
 }
 
@@ -474,6 +873,7 @@ void VulkanSDL2App::pickPhysicalDevice() {
         }
     }
     physicalDeviceName = std::string(physicalDevice.getProperties().deviceName);
+    copyRowPitchAlignment = std::max<vk::DeviceSize>(1, physicalDevice.getProperties().limits.optimalBufferCopyRowPitchAlignment);
 }
 
 void VulkanSDL2App::createLogicalDevice() {
@@ -595,6 +995,9 @@ void VulkanSDL2App::createImageViews() {
 }
 
 void VulkanSDL2App::createRenderPass() {
+    // created before the swapchain, the format doesn't depend on the window size
+    swapChainImageFormat = chooseSwapSurfaceFormat(querySwapChainSupport(physicalDevice).formats).format;
+
     vk::AttachmentDescription colorAttachment = {
         vk::AttachmentDescriptionFlags(),
         swapChainImageFormat,
@@ -677,6 +1080,58 @@ void VulkanSDL2App::createGraphicsDescriptorSetLayout() {
     graphicsDescriptorSetLayout = device.createDescriptorSetLayout(createInfo);
 }
 
+static std::filesystem::path pipelineCachePath(const vk::PhysicalDeviceProperties& properties) {
+    auto dir = CacheDir::get();
+    if (dir.empty()) {
+        return {};
+    }
+    char name[64];
+    std::snprintf(name, sizeof(name), "pipeline_%04x_%04x.bin", properties.vendorID, properties.deviceID);
+    return dir / name;
+}
+
+void VulkanSDL2App::createPipelineCache() {
+    auto properties = physicalDevice.getProperties();
+    auto path = pipelineCachePath(properties);
+
+    std::vector<char> data;
+    if (!path.empty() && CacheDir::readFile(path, data)) {
+        // VkPipelineCacheHeaderVersionOne: headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+        bool valid = data.size() >= 16 + VK_UUID_SIZE;
+        if (valid) {
+            uint32_t header[4];
+            std::memcpy(header, data.data(), sizeof(header));
+            valid = header[0] >= 16 + VK_UUID_SIZE
+                && header[1] == static_cast<uint32_t>(vk::PipelineCacheHeaderVersion::eOne)
+                && header[2] == properties.vendorID
+                && header[3] == properties.deviceID
+                && std::memcmp(data.data() + 16, properties.pipelineCacheUUID.data(), VK_UUID_SIZE) == 0;
+        }
+        if (!valid) {
+            // written by another driver version, let the driver start from scratch
+            std::printf("Discarding stale pipeline cache %s\n", path.c_str());
+            data.clear();
+        }
+    } else {
+        data.clear();
+    }
+
+    pipelineCache = device.createPipelineCache(
+        vk::PipelineCacheCreateInfo({}, data.size(), data.empty() ? nullptr : data.data())
+    );
+}
+
+void VulkanSDL2App::savePipelineCache() {
+    auto path = pipelineCachePath(physicalDevice.getProperties());
+    if (path.empty()) {
+        return;
+    }
+    auto data = device.getPipelineCacheData(pipelineCache);
+    if (!data.empty() && !CacheDir::writeFile(path, data.data(), data.size())) {
+        std::printf("Couldn't write pipeline cache %s\n", path.c_str());
+    }
+}
+
 void VulkanSDL2App::createGraphicsPipeline() {
     vk::ShaderModule vertShaderModule = createShaderModule(vert_spv, vert_spv_len);
     vk::ShaderModule fragShaderModule = createShaderModule(frag_spv, frag_spv_len);
@@ -776,7 +1231,7 @@ void VulkanSDL2App::createGraphicsPipeline() {
         {}, -1
     };
 
-    auto res = device.createGraphicsPipeline({}, pipelineInfo);
+    auto res = device.createGraphicsPipeline(pipelineCache, pipelineInfo);
     if (res.result != vk::Result::eSuccess) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
@@ -804,6 +1259,8 @@ void VulkanSDL2App::createCommandBuffers() {
             static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT)
         )
     );
+    commandBuffersDirty.assign(commandBuffers.size(), true);
+    previewShown.assign(commandBuffers.size(), false);
 }
 
 void VulkanSDL2App::createVertexBuffer() {
@@ -840,13 +1297,14 @@ void VulkanSDL2App::createVertexBuffer() {
 }
 
 void VulkanSDL2App::createDescriptorPool() {
+    // one set per swapchain image, and the thumbnail atlas
     std::array<vk::DescriptorPoolSize, 1> poolSizes;
     poolSizes[0].type = vk::DescriptorType::eCombinedImageSampler;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT + 1);
 
     graphicsDescriptorPool = device.createDescriptorPool(
         vk::DescriptorPoolCreateInfo(
-            {}, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT),
+            {}, static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT + 1),
             static_cast<uint32_t>(poolSizes.size()), poolSizes.data()
         )
     );
@@ -859,6 +1317,9 @@ void VulkanSDL2App::createDescriptorSets() {
             graphicsDescriptorPool, static_cast<uint32_t>(layouts.size()), layouts.data()
         )
     );
+    thumbnailDescriptorSet = device.allocateDescriptorSets(
+        vk::DescriptorSetAllocateInfo(graphicsDescriptorPool, 1, &graphicsDescriptorSetLayout)
+    ).front();
 }
 
 void VulkanSDL2App::initTextureResource() {
@@ -866,10 +1327,22 @@ void VulkanSDL2App::initTextureResource() {
     textures.assign(MAX_FRAMES_IN_FLIGHT, texture);
 }
 
+void VulkanSDL2App::createThumbnailResources() {
+    thumbnailAtlas.emplace(device);
+
+    vk::DeviceSize bufferSize = sizeof(Vertex) * 4 * MAX_FRAMES_IN_FLIGHT;
+    createBuffer(bufferSize, vk::BufferUsageFlagBits::eVertexBuffer,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        previewVertexBuffer, previewVertexMemory
+    );
+    previewVertices = static_cast<Vertex*>(device.mapMemory(previewVertexMemory, 0, bufferSize));
+}
+
 void VulkanSDL2App::createSyncObjects() {
     imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imagesInFlight.assign(swapChainImages.size(), nullptr);
 
     vk::SemaphoreCreateInfo semaphoreInfo = {};
     vk::FenceCreateInfo fenceInfo = {
@@ -903,15 +1376,27 @@ void VulkanSDL2App::DrawFrame(std::shared_ptr<FFmpegDecoder::Frame> frame) {
         return;
     }
 
+    // the texture and command buffer of this image may still be used by an earlier frame
+    if (imagesInFlight[imageIndex] != vk::Fence{}) {
+        if (device.waitForFences(1, &imagesInFlight[imageIndex],
+            vk::True, UINT64_MAX) != vk::Result::eSuccess) {
+            throw std::runtime_error("waitForFences error!");
+        }
+    }
+    imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
     updateTexture(imageIndex, std::move(frame));
+    updateScrubPreview(imageIndex);
 
     if (device.resetFences(1, &inFlightFences[currentFrame]) != vk::Result::eSuccess) {
         throw std::runtime_error("failed to reset fence!");
     }
 
-    commandBuffers[currentFrame].reset(vk::CommandBufferResetFlags(0));
-
-    recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+    if (commandBuffersDirty[imageIndex]) {
+        commandBuffers[imageIndex].reset(vk::CommandBufferResetFlags(0));
+        recordCommandBuffer(commandBuffers[imageIndex], imageIndex);
+        commandBuffersDirty[imageIndex] = false;
+    }
 
     vk::Semaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
     vk::PipelineStageFlags waitStages[] = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
@@ -919,7 +1404,7 @@ void VulkanSDL2App::DrawFrame(std::shared_ptr<FFmpegDecoder::Frame> frame) {
 
     vk::SubmitInfo submitInfo = {
         1, waitSemaphores, waitStages,
-        1, &commandBuffers[currentFrame],
+        1, &commandBuffers[imageIndex],
         1, signalSemaphores
     };
 
@@ -958,63 +1443,111 @@ void VulkanSDL2App::cleanupSwapChain() {
 }
 
 void VulkanSDL2App::reCreateSwapChain() {
+    size_t imageCount = swapChainImages.size();
     createSwapChain();
     createImageViews();
     createFrameBuffers();
 
+    // the new swapchain may come with another number of images, everything kept per image follows it
+    if (swapChainImages.size() != imageCount) {
+        recreateFrameResources();
+    }
+
+    imagesInFlight.assign(swapChainImages.size(), nullptr);
+    updateViewport();
+
     frameBufferResized = false;
 }
 
-void VulkanSDL2App::updateTexture(uint32_t imageIndex, std::shared_ptr<FFmpegDecoder::Frame> frame) {
-    if (textures[imageIndex].useful) {
-        textures[imageIndex].destroy();
+void VulkanSDL2App::recreateFrameResources() {
+    // createSwapChain waited for the device, nothing below is in use anymore
+    device.freeCommandBuffers(commandPool, commandBuffers.size(), commandBuffers.data());
+    createCommandBuffers();
+
+    // the pool is sized by the image count, the sets go with it; the textures bound to them and the
+    // atlas are made again by the next frames
+    textures = std::vector<Texture>();
+    device.destroyDescriptorPool(graphicsDescriptorPool);
+    createDescriptorPool();
+    createDescriptorSets();
+    initTextureResource();
+
+    device.unmapMemory(previewVertexMemory);
+    device.destroyBuffer(previewVertexBuffer);
+    device.freeMemory(previewVertexMemory);
+    createThumbnailResources();
+    thumbnailCopyImage = -1;
+    thumbnailRevision = 0;
+
+    for (size_t i = 0; i < inFlightFences.size(); ++i) {
+        device.destroySemaphore(imageAvailableSemaphores[i]);
+        device.destroySemaphore(renderFinishedSemaphores[i]);
+        device.destroyFence(inFlightFences[i]);
     }
+    createSyncObjects();
+    currentFrame = 0;
+}
 
-    // auto frame = ffmpegDecoder->getVideoFrame();
+void VulkanSDL2App::updateViewport() {
+    float viewX = 0.0, viewY = 0.0;
+    int viewportWidth, viewportHeight;
 
-    int textureWidth = frame->data->width;
-    int textureHeight = frame->data->height;
-    vk::DeviceSize imageSize = textureWidth * textureHeight * 4;
+    int extentWidth = swapChainExtent.width, extentHeight= swapChainExtent.height;
 
-    vk::Buffer stagingBuffer;
-    vk::DeviceMemory stagingMemory;
-    createBuffer(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-        stagingBuffer, stagingMemory
+    float aspectRatioWindow = static_cast<float>(extentWidth) / static_cast<float>(extentHeight);
+    float aspectRatioMedia = static_cast<float>(mediaWidth) / static_cast<float>(mediaHeight);
+
+    if (aspectRatioMedia > aspectRatioWindow) {
+        viewportWidth = extentWidth;
+        viewportHeight = extentWidth / aspectRatioMedia;
+        viewX = 0.0f;
+        viewY = static_cast<float>(extentHeight - viewportHeight) / 2.0f;
+    } else {
+        viewportHeight = extentHeight;
+        viewportWidth = extentHeight * aspectRatioMedia;
+        viewX = static_cast<float>(extentWidth - viewportWidth) / 2.0f;
+        viewY = 0.0f;
+    }
+    viewport = vk::Viewport(
+        viewX, viewY,
+        static_cast<float>(viewportWidth), static_cast<float>(viewportHeight),
+        0.0f, 1.0f
     );
 
-    void *data = device.mapMemory(stagingMemory, 0, imageSize);
-    memcpy(data, frame->data->data[0], static_cast<size_t>(imageSize));
-    device.unmapMemory(stagingMemory);
+    // no point in converting and uploading more pixels than the viewport shows
+    if (ffmpegDecoder) {
+        ffmpegDecoder->setOutputSize(viewportWidth, viewportHeight);
+    }
 
+    invalidateCommandBuffers();
+}
 
-    createImage(static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight), 1, vk::SampleCountFlagBits::e1,
-        vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal,
-        vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst
-        | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal,
-        textures[imageIndex].image, textures[imageIndex].memory
-    );
+void VulkanSDL2App::invalidateCommandBuffers() {
+    commandBuffersDirty.assign(commandBuffers.size(), true);
+}
 
-    transitionImageLayout(textures[imageIndex].image, vk::Format::eR8G8B8A8Srgb,
-        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, 1
-    );
+void VulkanSDL2App::createTextureResource(Texture& texture, vk::DescriptorSet descriptorSet,
+    uint32_t width, uint32_t height, uint32_t rowPitch) {
+    texture.destroy();
 
-    copyBufferToImage(
-        stagingBuffer, textures[imageIndex].image,
-        static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight)
+    vk::DeviceSize imageSize = static_cast<vk::DeviceSize>(rowPitch) * height;
+    createBuffer(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
+        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+        texture.stagingBuffer, texture.stagingMemory
     );
+    texture.stagingData = device.mapMemory(texture.stagingMemory, 0, imageSize);
 
-    device.destroyBuffer(stagingBuffer);
-    device.freeMemory(stagingMemory);
-
-    transitionImageLayout(textures[imageIndex].image, vk::Format::eR8G8B8A8Srgb,
-        vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 1
+    createImage(width, height, 1, vk::SampleCountFlagBits::e1,
+        vk::Format::eR8G8B8A8Srgb, vk::ImageTiling::eOptimal,
+        vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst
+        | vk::ImageUsageFlagBits::eSampled, vk::MemoryPropertyFlagBits::eDeviceLocal,
+        texture.image, texture.memory
     );
 
     // create image view
-    textures[imageIndex].imageView = device.createImageView(
+    texture.imageView = device.createImageView(
         vk::ImageViewCreateInfo(
-            {}, textures[imageIndex].image,
+            {}, texture.image,
             vk::ImageViewType::e2D, vk::Format::eR8G8B8A8Srgb, {},
             vk::ImageSubresourceRange(
                 vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1
@@ -1023,7 +1556,7 @@ void VulkanSDL2App::updateTexture(uint32_t imageIndex, std::shared_ptr<FFmpegDec
     );
 
     // create sampler
-    textures[imageIndex].sampler = device.createSampler(
+    texture.sampler = device.createSampler(
         vk::SamplerCreateInfo(
             {}, vk::Filter::eLinear, vk::Filter::eLinear,
             vk::SamplerMipmapMode::eLinear,
@@ -1039,26 +1572,189 @@ void VulkanSDL2App::updateTexture(uint32_t imageIndex, std::shared_ptr<FFmpegDec
 
     // update descriptor set
     vk::DescriptorImageInfo imageInfo = {
-        textures[imageIndex].sampler, textures[imageIndex].imageView, vk::ImageLayout::eShaderReadOnlyOptimal
+        texture.sampler, texture.imageView, vk::ImageLayout::eShaderReadOnlyOptimal
     };
 
     std::array<vk::WriteDescriptorSet, 1> descriptorWrites = {
         vk::WriteDescriptorSet(
-            graphicsDescriptorSets[imageIndex], 0, 0,
+            descriptorSet, 0, 0,
             1, vk::DescriptorType::eCombinedImageSampler,
             &imageInfo
         )
     };
 
-    textures[imageIndex].useful = true;
-
     device.updateDescriptorSets(static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    texture.width = width;
+    texture.height = height;
+    texture.rowPitch = rowPitch;
+    texture.useful = true;
+}
+
+uint32_t VulkanSDL2App::alignedRowPitch(uint32_t width) {
+    auto alignment = static_cast<uint32_t>(std::lcm<vk::DeviceSize>(copyRowPitchAlignment, 4));
+    return (width * 4 + alignment - 1) / alignment * alignment;
+}
+
+void VulkanSDL2App::updateTexture(uint32_t imageIndex, std::shared_ptr<FFmpegDecoder::Frame> frame) {
+    uint32_t textureWidth = static_cast<uint32_t>(frame->data->width);
+    uint32_t textureHeight = static_cast<uint32_t>(frame->data->height);
+    uint32_t linesize = static_cast<uint32_t>(frame->data->linesize[0]);
+
+    // keep the frame's own stride when the device copies it efficiently, so the upload is one memcpy,
+    // otherwise rows are repacked to the preferred pitch
+    uint32_t rowPitch = linesize;
+    if (rowPitch % copyRowPitchAlignment != 0 || rowPitch % 4 != 0) {
+        rowPitch = alignedRowPitch(textureWidth);
+    }
+
+    // reallocate only when the video size or stride changes
+    Texture& texture = textures[imageIndex];
+    if (!texture.useful || texture.width != textureWidth || texture.height != textureHeight || texture.rowPitch != rowPitch) {
+        createTextureResource(texture, graphicsDescriptorSets[imageIndex], textureWidth, textureHeight, rowPitch);
+        // the recorded command buffer references the old descriptor set contents
+        commandBuffersDirty[imageIndex] = true;
+    }
+
+    // the staging-to-image copy itself is part of the pre-recorded command buffer
+    const uint8_t* src = frame->data->data[0];
+    auto* dst = static_cast<uint8_t*>(texture.stagingData);
+    if (rowPitch == linesize) {
+        memcpy(dst, src, static_cast<size_t>(rowPitch) * textureHeight);
+    } else {
+        for (uint32_t y = 0; y < textureHeight; ++y) {
+            memcpy(dst + static_cast<size_t>(y) * rowPitch, src + static_cast<size_t>(y) * linesize, textureWidth * 4);
+        }
+    }
+}
+
+bool VulkanSDL2App::uploadThumbnails(uint32_t imageIndex) {
+    Texture& atlas = *thumbnailAtlas;
+    auto size = thumbnails->atlasSize();
+    auto width = static_cast<uint32_t>(size[0]), height = static_cast<uint32_t>(size[1]);
+    bool resized = !atlas.useful || atlas.width != width || atlas.height != height;
+
+    // every upload copies the whole atlas, tiles coming in are batched; the staging buffer is only
+    // rewritten once the copy out of it has run
+    uint64_t revision = thumbnails->revision();
+    auto now = std::chrono::steady_clock::now();
+    if (revision != thumbnailRevision && (thumbnailCopyImage < 0 || resized)
+        && (thumbnailRevision == 0 || now - thumbnailUpload >= std::chrono::milliseconds(500))) {
+        if (resized) {
+            // once an item: only the frames drawing the old atlas or copying into it are waited for
+            for (size_t i = 0; i < imagesInFlight.size(); ++i) {
+                bool usesAtlas = previewShown[i] || static_cast<int>(i) == thumbnailCopyImage;
+                if (usesAtlas && imagesInFlight[i] != vk::Fence{}
+                    && device.waitForFences(1, &imagesInFlight[i], vk::True, UINT64_MAX) != vk::Result::eSuccess) {
+                    throw std::runtime_error("waitForFences error!");
+                }
+            }
+            createTextureResource(atlas, thumbnailDescriptorSet, width, height, alignedRowPitch(width));
+            invalidateCommandBuffers();
+        }
+        thumbnails->copyAtlas(static_cast<uint8_t*>(atlas.stagingData), atlas.rowPitch);
+
+        // the staging-to-image copy is recorded ahead of this image's render pass
+        thumbnailCopyImage = static_cast<int>(imageIndex);
+        commandBuffersDirty[imageIndex] = true;
+
+        thumbnailRevision = revision;
+        thumbnailUpload = now;
+        resized = false;
+    }
+    return thumbnailRevision != 0 && !resized;
+}
+
+void VulkanSDL2App::updateScrubPreview(uint32_t imageIndex) {
+    scrubPreview.changed = false;
+    double position = scrubPreview.position;
+
+    // the atlas copy recorded for this image has run, it isn't repeated
+    if (thumbnailCopyImage == static_cast<int>(imageIndex)) {
+        thumbnailCopyImage = -1;
+        commandBuffersDirty[imageIndex] = true;
+    }
+
+    bool show = false;
+    ThumbnailGenerator::Tile tile{};
+    if (thumbnails && position >= 0.0) {
+        bool uploaded = uploadThumbnails(imageIndex);
+        // asked for even before anything can be shown, so the position hovered over is made first
+        show = thumbnails->tileAt(position * thumbnails->getDuration(), thumbnailRevision, tile) && uploaded;
+    }
+
+    if (show) {
+        // a fifth of the window wide, centred above the pointer, kept inside the window
+        auto extentWidth = static_cast<float>(swapChainExtent.width);
+        auto extentHeight = static_cast<float>(swapChainExtent.height);
+        float width = extentWidth / 5.0f;
+        float height = width * static_cast<float>(tile.height) / static_cast<float>(tile.width);
+        float left = std::clamp(static_cast<float>(position) * extentWidth - width / 2.0f, 0.0f, extentWidth - width);
+        float bottom = extentHeight * 7.0f / 8.0f - 8.0f;
+        float top = std::max(0.0f, bottom - height);
+
+        auto x = [extentWidth](float pixel) { return pixel / extentWidth * 2.0f - 1.0f; };
+        auto y = [extentHeight](float pixel) { return pixel / extentHeight * 2.0f - 1.0f; };
+        // half a texel in, linear filtering would pick up the neighbouring tiles otherwise
+        auto atlasSize = thumbnails->atlasSize();
+        float u0 = (static_cast<float>(tile.x) + 0.5f) / static_cast<float>(atlasSize[0]);
+        float u1 = (static_cast<float>(tile.x + tile.width) - 0.5f) / static_cast<float>(atlasSize[0]);
+        float v0 = (static_cast<float>(tile.y) + 0.5f) / static_cast<float>(atlasSize[1]);
+        float v1 = (static_cast<float>(tile.y + tile.height) - 0.5f) / static_cast<float>(atlasSize[1]);
+
+        // same winding as the video quad, the image isn't in flight so its vertices can be rewritten
+        Vertex* vertices = previewVertices + imageIndex * 4;
+        vertices[0] = {{x(left), y(bottom)}, {u0, v1}};
+        vertices[1] = {{x(left + width), y(bottom)}, {u1, v1}};
+        vertices[2] = {{x(left + width), y(top)}, {u1, v0}};
+        vertices[3] = {{x(left), y(top)}, {u0, v0}};
+    }
+
+    if (show != previewShown[imageIndex]) {
+        previewShown[imageIndex] = show;
+        commandBuffersDirty[imageIndex] = true;
+    }
 }
 
 void VulkanSDL2App::recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex) {
     // begin command buffer
     commandBuffer.begin(vk::CommandBufferBeginInfo());
 
+    // upload the staging buffer, previous contents are overwritten entirely so the old layout is discarded
+    const Texture& texture = textures[imageIndex];
+    transitionImageLayout(commandBuffer, texture.image, vk::Format::eR8G8B8A8Srgb,
+        vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, 1
+    );
+
+    copyBufferToImage(commandBuffer, texture.stagingBuffer, texture.image, texture.width, texture.height,
+        texture.rowPitch / 4);
+
+    transitionImageLayout(commandBuffer, texture.image, vk::Format::eR8G8B8A8Srgb,
+        vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 1
+    );
+
+    // new thumbnails; earlier frames may still sample the atlas, the copy waits for their fragment
+    // shaders and later ones for the copy. It is rewritten entirely, the old contents are discarded
+    if (thumbnailCopyImage == static_cast<int>(imageIndex)) {
+        const Texture& atlas = *thumbnailAtlas;
+        vk::ImageMemoryBarrier barrier(
+            vk::AccessFlags(0), vk::AccessFlagBits::eTransferWrite,
+            vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+            vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, atlas.image,
+            vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1)
+        );
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eFragmentShader, vk::PipelineStageFlagBits::eTransfer,
+            vk::DependencyFlags(0), 0, nullptr, 0, nullptr, 1, &barrier
+        );
+
+        copyBufferToImage(commandBuffer, atlas.stagingBuffer, atlas.image, atlas.width, atlas.height,
+            atlas.rowPitch / 4);
+
+        transitionImageLayout(commandBuffer, atlas.image, vk::Format::eR8G8B8A8Srgb,
+            vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 1
+        );
+    }
+
     vk::RenderPassBeginInfo renderPassInfo = {};
     renderPassInfo.renderPass = renderPass;
     renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
@@ -1083,31 +1779,6 @@ void VulkanSDL2App::recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_
     commandBuffer.bindVertexBuffers(0, vertexBuffers, offsets);
 
     // viewport
-    float viewX = 0.0, viewY = 0.0;
-    int viewportWidth, viewportHeight;
-
-
-    int extentWidth = swapChainExtent.width, extentHeight= swapChainExtent.height;
-
-    float aspectRatioWindow = static_cast<float>(extentWidth) / static_cast<float>(extentHeight);
-    float aspectRatioMedia = static_cast<float>(mediaWidth) / static_cast<float>(mediaHeight);
-
-    if (aspectRatioMedia > aspectRatioWindow) {
-        viewportWidth = extentWidth;
-        viewportHeight = extentWidth / aspectRatioMedia;
-        viewX = 0.0f;
-        viewY = static_cast<float>(extentHeight - viewportHeight) / 2.0f;
-    } else {
-        viewportHeight = extentHeight;
-        viewportWidth = extentHeight * aspectRatioMedia;
-        viewX = static_cast<float>(extentWidth - viewportWidth) / 2.0f;
-        viewY = 0.0f;
-    }
-    vk::Viewport viewport = {
-        viewX, viewY,
-        static_cast<float>(viewportWidth), static_cast<float>(viewportHeight),
-        0.0f, 1.0f
-    };
     commandBuffer.setViewport(0, 1, &viewport);
 
     vk::Rect2D scissor = {
@@ -1125,6 +1796,28 @@ void VulkanSDL2App::recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_
 
     commandBuffer.draw(4, 1, 0, 0);
 
+    // the scrub preview, positioned in the whole window rather than the letterboxed video
+    if (previewShown[imageIndex]) {
+        vk::Viewport windowViewport(
+            0.0f, 0.0f,
+            static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height),
+            0.0f, 1.0f
+        );
+        commandBuffer.setViewport(0, 1, &windowViewport);
+
+        vk::Buffer previewBuffers[] = {previewVertexBuffer};
+        vk::DeviceSize previewOffsets[] = {sizeof(Vertex) * 4 * imageIndex};
+        commandBuffer.bindVertexBuffers(0, previewBuffers, previewOffsets);
+
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eGraphics, graphicsPipelineLayout,
+            0, 1, &thumbnailDescriptorSet,
+            0, nullptr
+        );
+
+        commandBuffer.draw(4, 1, 0, 0);
+    }
+
     // end render pass
     commandBuffer.endRenderPass();
 
@@ -1341,6 +2034,13 @@ void VulkanSDL2App::transitionImageLayout(vk::Image image, vk::Format format, vk
     vk::ImageLayout newLayout, uint32_t mipLevels) {
     vk::CommandBuffer commandBuffer = beginSingleTimeCommands();
 
+    transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, mipLevels);
+
+    endSingleTimeCommands(commandBuffer);
+}
+
+void VulkanSDL2App::transitionImageLayout(vk::CommandBuffer commandBuffer, vk::Image image, vk::Format format,
+    vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t mipLevels) {
     vk::ImageMemoryBarrier barrier{};
     barrier.oldLayout = oldLayout;
     barrier.newLayout = newLayout;
@@ -1377,15 +2077,21 @@ void VulkanSDL2App::transitionImageLayout(vk::Image image, vk::Format format, vk
         0, nullptr, 0, nullptr,
         1, &barrier
     );
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 void VulkanSDL2App::copyBufferToImage(vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height) {
     vk::CommandBuffer commandBuffer = beginSingleTimeCommands();
 
+    copyBufferToImage(commandBuffer, buffer, image, width, height);
+
+    endSingleTimeCommands(commandBuffer);
+}
+
+void VulkanSDL2App::copyBufferToImage(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::Image image,
+    uint32_t width, uint32_t height, uint32_t rowLength) {
+    // rowLength is in texels, 0 means tightly packed
     vk::BufferImageCopy region = {
-        0, 0, 0,
+        0, rowLength, 0,
         vk::ImageSubresourceLayers(
             vk::ImageAspectFlagBits::eColor, 0, 0, 1
         ),
@@ -1396,8 +2102,6 @@ void VulkanSDL2App::copyBufferToImage(vk::Buffer buffer, vk::Image image, uint32
     commandBuffer.copyBufferToImage(
         buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &region
     );
-
-    endSingleTimeCommands(commandBuffer);
 }
 
 vk::CommandBuffer VulkanSDL2App::beginSingleTimeCommands() {
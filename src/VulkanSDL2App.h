@@ -3,15 +3,62 @@
 #include <SDL2/SDL_vulkan.h>
 #include <string>
 #include <optional>
+#include <future>
+#include <vector>
+#include <chrono>
 #include <glm/glm.hpp>
 #include "FFmpegDecoder.h"
 #include "SDLAudioPlayer.h"
+#include "ThumbnailGenerator.h"
 
 struct Config {
 
     bool DiscreteGpuFirst = false;
 
     bool autoReplay = false;
+
+    // present the first decoded frame without waiting for the audio clock
+    bool fastStart = false;
+
+    // -ss, in seconds
+    double startTime = 0.0;
+
+    // stream probing, 0 keeps the ffmpeg defaults
+    int64_t probeSize = 0;
+    int64_t analyzeDuration = 0;
+    bool probeCache = true;
+
+    // memory for speculative seek frames, in bytes, 0 disables prefetching
+    size_t prefetchBudget = 0;
+
+    // -io, how local files are read
+    MediaIO::Backend ioBackend = MediaIO::Backend::Default;
+    size_t readAheadWindow = 32 * 1024 * 1024;
+
+    // -demux, whether audio gets its own demuxer
+    DemuxMode demuxMode = DemuxMode::Auto;
+
+    // -buffer, network buffering watermarks in seconds
+    double bufferLow = 2.0;
+    double bufferHigh = 8.0;
+
+    // -live and -latency, low latency playback for sources read as they arrive
+    bool live = false;
+    double maxLatency = 0.1;
+
+    // -loopcache, memory for the decoded frames of a loop segment, in bytes
+    size_t loopCacheBudget = static_cast<size_t>(2048) * 1024 * 1024;
+    // -gopcache, memory for the decoded GOPs of frame stepping and reverse play, in bytes
+    size_t gopCacheBudget = 512 * 1024 * 1024;
+
+    // -speed, playback speed, kept across playlist items
+    double speed = 1.0;
+
+    // -nothumbnails, scrub preview thumbnails of local files, generated in the background and cached on disk
+    bool thumbnails = true;
+
+    // every item in play order, the first one included, -r loops the whole list
+    std::vector<std::string> playlist;
 };
 
 class VulkanSDL2App {
@@ -75,15 +122,57 @@ private:
     std::mutex windowResizeMutex;
     int windowWidth, windowHeight;
     int mediaWidth, mediaHeight;
+    int displayWidth = 0, displayHeight = 0;
     bool isFullscreen = false;
     std::atomic<bool> frameBufferResized = false;
 
     std::atomic<bool> running = true;
 
+    // startup timing, in milliseconds
+    struct StartupTimes {
+        double media = 0.0;
+        double vulkan = 0.0;
+        double total = 0.0;
+    };
+    StartupTimes startupTimes;
+    std::chrono::steady_clock::time_point startupBegin;
+    void reportTimeToFirstAudio();
+
     SDL_Window* window;
 
-    FFmpegDecoder* ffmpegDecoder;
+    FFmpegDecoder* ffmpegDecoder = nullptr;
     SDLAudioPlayer* audioPlayer;
+    SDL_AudioSpec audioSpec{};
+
+    // playlist: the next item is opened and decoding its first frames while the current one plays,
+    // the draw thread swaps it in under decoderMutex, which the event loop holds while using the decoder
+    struct PreloadedItem {
+        FFmpegDecoder* decoder = nullptr;
+        size_t index = 0;
+    };
+    std::mutex decoderMutex;
+    size_t playlistIndex = 0;
+    std::future<PreloadedItem> nextItem;
+    std::vector<FFmpegDecoder*> retiredDecoders;
+    DecoderConfig makeDecoderConfig(const std::string& filename, bool firstItem);
+    void preloadNextItem();
+    bool advancePlaylist();
+    void releaseRetiredDecoders(bool wait);
+
+    // scrub preview: a thumbnail of the position under the mouse while it hovers over the bottom of
+    // the window, where right clicks seek to; the event loop sets the hover position, everything else
+    // belongs to the draw thread, generators of earlier items are released with the decoders
+    ThumbnailGenerator* thumbnails = nullptr;
+    std::vector<ThumbnailGenerator*> retiredThumbnails;
+    struct ScrubPreview {
+        // fraction of the window width, negative while not hovering
+        std::atomic<double> position = -1.0;
+        std::atomic<bool> changed = false;
+    };
+    ScrubPreview scrubPreview;
+    void createThumbnails();
+    void hoverScrubBar(int x, int y);
+    bool scrubPreviewChanged();
 
     // data about vulkan
     std::atomic<bool> drawThreadExited = false;
@@ -97,6 +186,8 @@ private:
 
     vk::PhysicalDevice physicalDevice = VK_NULL_HANDLE;
     std::string physicalDeviceName;
+    // staging rows at a multiple of this copy fastest
+    vk::DeviceSize copyRowPitchAlignment = 1;
     vk::Device device;
 
     vk::Queue graphicsQueue;
@@ -111,6 +202,8 @@ private:
     std::vector<vk::Framebuffer> swapChainFramebuffers;
 
     vk::RenderPass renderPass;
+    // shared by every pipeline the app creates, persisted in the per-user cache directory
+    vk::PipelineCache pipelineCache;
     vk::PipelineLayout graphicsPipelineLayout;
     vk::Pipeline graphicsPipeline;
 
@@ -119,7 +212,12 @@ private:
     std::vector<vk::DescriptorSet> graphicsDescriptorSets;
 
     vk::CommandPool commandPool;
+    // one pre-recorded command buffer per swapchain image, re-recorded only when dirty
     std::vector<vk::CommandBuffer> commandBuffers;
+    std::vector<bool> commandBuffersDirty;
+
+    // letterboxed viewport, recomputed when the swapchain or media size changes
+    vk::Viewport viewport;
 
     vk::Buffer vertexBuffer;
     vk::DeviceMemory vertexBufferMemory;
@@ -138,6 +236,16 @@ private:
         vk::ImageView imageView;
         vk::Sampler sampler;
 
+        // persistently mapped staging buffer, reused by every upload of the same size
+        vk::Buffer stagingBuffer;
+        vk::DeviceMemory stagingMemory;
+        void* stagingData = nullptr;
+
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // bytes per row in the staging buffer, may be padded past width * 4
+        uint32_t rowPitch = 0;
+
         bool useful = false;
 
         void destroy() {
@@ -146,6 +254,11 @@ private:
                 device.destroyImageView(imageView);
                 device.destroyImage(image);
                 device.freeMemory(memory);
+                device.unmapMemory(stagingMemory);
+                device.destroyBuffer(stagingBuffer);
+                device.freeMemory(stagingMemory);
+                stagingData = nullptr;
+                width = height = rowPitch = 0;
                 useful = false;
             }
         }
@@ -153,15 +266,33 @@ private:
 
     std::vector<Texture> textures;
 
+    // thumbnail atlas, sampled through the video pipeline with its own descriptor set; uploaded only
+    // while the preview shows, at most twice a second
+    std::optional<Texture> thumbnailAtlas;
+    vk::DescriptorSet thumbnailDescriptorSet;
+    uint64_t thumbnailRevision = 0;
+    std::chrono::steady_clock::time_point thumbnailUpload;
+    // the image whose command buffer copies the atlas staging buffer in, -1 once that has run
+    int thumbnailCopyImage = -1;
+    // the preview quad of each swapchain image, host visible so a hover only rewrites its vertices
+    vk::Buffer previewVertexBuffer;
+    vk::DeviceMemory previewVertexMemory;
+    Vertex* previewVertices = nullptr;
+    // whether the recorded command buffer of each image draws the preview
+    std::vector<bool> previewShown;
+
     uint32_t currentFrame = 0;
     int MAX_FRAMES_IN_FLIGHT;
     std::vector<vk::Semaphore> imageAvailableSemaphores;
     std::vector<vk::Semaphore> renderFinishedSemaphores;
     std::vector<vk::Fence> inFlightFences;
+    std::vector<vk::Fence> imagesInFlight;
 
 
     // functions
     void initWindow();
+    void initMedia();
+    void resizeWindowToMedia();
 
     void printAppInfos();
 
@@ -169,10 +300,13 @@ private:
     void togglePause();
     void updateVolume(int sign);
 
+    void updateSpeed(int sign);
+
     // functions about vulkan
     void destroyVulkan();
 
-    void initVulkan();
+    void initVulkanDevice();
+    void initVulkanSwapChain();
     void createInstance();
     void createSurface();
     void pickPhysicalDevice();
@@ -182,6 +316,8 @@ private:
     void createRenderPass();
     void createFrameBuffers();
     void createGraphicsDescriptorSetLayout();
+    void createPipelineCache();
+    void savePipelineCache();
     void createGraphicsPipeline();
     void createCommandPool();
     void createCommandBuffers();
@@ -189,14 +325,24 @@ private:
     void createDescriptorPool();
     void createDescriptorSets();
     void initTextureResource();
+    void createThumbnailResources();
     void createSyncObjects();
 
     void DrawFrame(std::shared_ptr<FFmpegDecoder::Frame> frame);
 
     void cleanupSwapChain();
     void reCreateSwapChain();
+    void recreateFrameResources();
+
+    void updateViewport();
+    void invalidateCommandBuffers();
 
+    void createTextureResource(Texture& texture, vk::DescriptorSet descriptorSet,
+                               uint32_t width, uint32_t height, uint32_t rowPitch);
+    uint32_t alignedRowPitch(uint32_t width);
     void updateTexture(uint32_t imageIndex, std::shared_ptr<FFmpegDecoder::Frame> frame);
+    bool uploadThumbnails(uint32_t imageIndex);
+    void updateScrubPreview(uint32_t imageIndex);
     void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex);
 
     // helper functions
@@ -223,8 +369,12 @@ private:
 
     void transitionImageLayout(vk::Image image, vk::Format format, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
                                uint32_t mipLevels);
+    void transitionImageLayout(vk::CommandBuffer commandBuffer, vk::Image image, vk::Format format,
+                               vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t mipLevels);
 
     void copyBufferToImage(vk::Buffer buffer, vk::Image image, uint32_t width, uint32_t height);
+    void copyBufferToImage(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::Image image,
+                           uint32_t width, uint32_t height, uint32_t rowLength = 0);
 
     vk::CommandBuffer beginSingleTimeCommands();
 
@@ -1,30 +1,181 @@
 #include "VulkanSDL2App.h"
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-#include <set>
+#include <stdexcept>
+#include <type_traits>
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cout << "Usage: " << argv[0] << " <file> " << " <Options>... "<< std::endl;
-        std::cout << "Options:" << std::endl;
-        std::cout << "-d for discrete gpu first(default integrated first)." << std::endl;
-        std::cout << "-r for replay(default not)." << std::endl;
-        return -1;
+// the whole text as a number, throws std::invalid_argument or std::out_of_range otherwise
+template<typename T>
+static T parseNumber(const std::string& text) {
+    size_t end = 0;
+    T value;
+    if constexpr (std::is_floating_point_v<T>) {
+        value = static_cast<T>(std::stod(text, &end));
+    } else if constexpr (std::is_signed_v<T>) {
+        value = static_cast<T>(std::stoll(text, &end));
+    } else {
+        // stoull takes "-1" as the largest value
+        if (text.find('-') != std::string::npos) {
+            throw std::invalid_argument(text);
+        }
+        value = static_cast<T>(std::stoull(text, &end));
+    }
+    if (end != text.size()) {
+        throw std::invalid_argument(text);
+    }
+    return value;
+}
+
+// accepts seconds ("90.5") or [hh:]mm:ss ("1:30")
+static double parseTime(const std::string& text) {
+    double seconds = 0.0;
+    size_t pos = 0;
+    while (true) {
+        size_t colon = text.find(':', pos);
+        seconds = seconds * 60 + parseNumber<double>(text.substr(pos, colon - pos));
+        if (colon == std::string::npos) {
+            break;
+        }
+        pos = colon + 1;
+    }
+    return seconds;
+}
+
+// one path per line, blank lines and lines starting with # are skipped
+static void readPlaylist(const std::string& path, std::vector<std::string>& playlist) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Couldn't open playlist " << path << std::endl;
+        return;
     }
+    // relative entries are relative to the list, wherever it is played from
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line.find("://") == std::string::npos && line != "-" && std::filesystem::path(line).is_relative()) {
+            line = (directory / line).string();
+        }
+        playlist.push_back(line);
+    }
+}
 
-    std::set<std::string> options;
-    for (int i = 2; i < argc; ++i) {
-        options.insert(std::string(argv[i]));
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " <file> [<file>...] " << " <Options>... "<< std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "-d for discrete gpu first(default integrated first)." << std::endl;
+    std::cout << "-r for replay, of the whole playlist when there are several files(default not)." << std::endl;
+    std::cout << "-playlist <file> to play the files listed in it, one per line, in command line order with the files given directly." << std::endl;
+    std::cout << "-fs for fast start, show the first frame as soon as it is decoded(default not)." << std::endl;
+    std::cout << "-ss <time> to start the first file at the given position, in seconds or [hh:]mm:ss." << std::endl;
+    std::cout << "-probesize <bytes> and -analyzeduration <microseconds> to limit stream probing." << std::endl;
+    std::cout << "-noprobecache to always probe instead of reusing cached stream info." << std::endl;
+    std::cout << "-nothumbnails to not generate the thumbnails previewed when hovering over the bottom of the window." << std::endl;
+    std::cout << "-io mmap|readahead to read local files through a memory mapping or a read-ahead thread(default ffmpeg's own reads)." << std::endl;
+    std::cout << "-readahead <MB> for the read-ahead window(default 32)." << std::endl;
+    std::cout << "-demux auto|single|split to read audio with its own demuxer, auto does so for badly interleaved files(default auto)." << std::endl;
+    std::cout << "-buffer <low>:<high> for network streams, rebuffer below low and resume at high seconds(default 2:8)." << std::endl;
+    std::cout << "-live for low latency playback without seeking, on by default for -(stdin), pipes and udp/rtp/srt." << std::endl;
+    std::cout << "-latency <ms> for live input, queued frames beyond it are dropped to catch up(default 100)." << std::endl;
+    std::cout << "-loopcache <MB> to replay loops and A-B repeats from decoded frames, 0 to decode every pass, at most half the memory(default 2048)." << std::endl;
+    std::cout << "-gopcache <MB> for the decoded GOPs of frame stepping and reverse play, 0 disables both(default 512)." << std::endl;
+    std::cout << "-speed <x> for the playback speed from 0.25 to 4, the pitch is kept(default 1)." << std::endl;
+    std::cout << "-prefetch <MB> to decode seek targets around the current position ahead, within the given memory(default off)." << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Config& config) {
+    std::string option;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            option = argv[i];
+            // the first argument is always a file, so "-" reads stdin
+            if (i == 1 && option != "-playlist") {
+                config.playlist.push_back(option);
+            } else if (option == "-playlist" && i + 1 < argc) {
+                readPlaylist(argv[++i], config.playlist);
+            } else if (option.rfind('-', 0) != 0) {
+                config.playlist.push_back(option);
+            } else if (option == "-d") {
+                config.DiscreteGpuFirst = true;
+            } else if (option == "-r") {
+                config.autoReplay = true;
+            } else if (option == "-fs") {
+                config.fastStart = true;
+            } else if (option == "-ss" && i + 1 < argc) {
+                config.startTime = parseTime(argv[++i]);
+            } else if (option == "-probesize" && i + 1 < argc) {
+                config.probeSize = parseNumber<int64_t>(argv[++i]);
+            } else if (option == "-analyzeduration" && i + 1 < argc) {
+                config.analyzeDuration = parseNumber<int64_t>(argv[++i]);
+            } else if (option == "-noprobecache") {
+                config.probeCache = false;
+            } else if (option == "-nothumbnails") {
+                config.thumbnails = false;
+            } else if (option == "-prefetch" && i + 1 < argc) {
+                config.prefetchBudget = parseNumber<size_t>(argv[++i]) * 1024 * 1024;
+            } else if (option == "-io" && i + 1 < argc) {
+                std::string backend(argv[++i]);
+                if (backend == "mmap") {
+                    config.ioBackend = MediaIO::Backend::Mmap;
+                } else if (backend == "readahead") {
+                    config.ioBackend = MediaIO::Backend::ReadAhead;
+                }
+            } else if (option == "-demux" && i + 1 < argc) {
+                std::string mode(argv[++i]);
+                if (mode == "single") {
+                    config.demuxMode = DemuxMode::Single;
+                } else if (mode == "split") {
+                    config.demuxMode = DemuxMode::Split;
+                } else {
+                    config.demuxMode = DemuxMode::Auto;
+                }
+            } else if (option == "-buffer" && i + 1 < argc) {
+                std::string watermarks(argv[++i]);
+                size_t colon = watermarks.find(':');
+                config.bufferLow = parseNumber<double>(watermarks.substr(0, colon));
+                if (colon != std::string::npos) {
+                    config.bufferHigh = parseNumber<double>(watermarks.substr(colon + 1));
+                }
+            } else if (option == "-loopcache" && i + 1 < argc) {
+                config.loopCacheBudget = parseNumber<size_t>(argv[++i]) * 1024 * 1024;
+            } else if (option == "-speed" && i + 1 < argc) {
+                config.speed = parseNumber<double>(argv[++i]);
+            } else if (option == "-gopcache" && i + 1 < argc) {
+                config.gopCacheBudget = parseNumber<size_t>(argv[++i]) * 1024 * 1024;
+            } else if (option == "-live") {
+                config.live = true;
+            } else if (option == "-latency" && i + 1 < argc) {
+                config.maxLatency = parseNumber<double>(argv[++i]) / 1000.0;
+            } else if (option == "-readahead" && i + 1 < argc) {
+                config.readAheadWindow = parseNumber<size_t>(argv[++i]) * 1024 * 1024;
+            }
+        }
+    } catch (const std::exception&) {
+        std::cout << "Invalid value for " << option << std::endl;
+        return false;
     }
+    return true;
+}
 
+int main(int argc, char* argv[]) {
     Config config;
-    if (options.count("-d")) {
-        config.DiscreteGpuFirst = true;
+    if (argc < 2 || !parseOptions(argc, argv, config)) {
+        printUsage(argv[0]);
+        return -1;
     }
-    if (options.count("-r")) {
-        config.autoReplay = true;
+
+    if (config.playlist.empty()) {
+        std::cout << "Nothing to play" << std::endl;
+        return -1;
     }
 
-    VulkanSDL2App app(std::string(argv[1]), 1920, 1080, config);
+    VulkanSDL2App app(config.playlist.front(), 1920, 1080, config);
     app.run();
     return 0;
 }
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+# Plays a clip from a loopback HTTP server that sends it slower than its bitrate, so the player
+# has to rebuffer, and checks it says so, resumes, and reaches the end instead of stalling.
+#
+#   network_buffering.py <player> [--fixture clip.mp4 --duration seconds]
+#
+# Exits 0 on success, 1 on failure and 77 when it can't run here (no display, no ffmpeg).
+
+import argparse
+import functools
+import http.server
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+SKIP = 77
+
+# the server sends this fraction of the clip's average bitrate, below 1 it has to run dry
+RATE_FACTOR = 0.6
+# -buffer low:high for the player, small so the test doesn't take long
+WATERMARKS = "1:3"
+
+
+def make_fixture(directory, duration):
+    ffmpeg = shutil.which("ffmpeg")
+    if ffmpeg is None:
+        return None
+    path = os.path.join(directory, "network.mp4")
+    # the index up front, so the player doesn't have to seek to the end of a throttled download
+    subprocess.run([ffmpeg, "-v", "error", "-y",
+                    "-f", "lavfi", "-i", "testsrc2=size=640x360:rate=25",
+                    "-f", "lavfi", "-i", "sine=frequency=440:sample_rate=48000",
+                    "-t", str(duration), "-pix_fmt", "yuv420p", "-g", "50",
+                    "-movflags", "+faststart", "-shortest", path],
+                   check=True)
+    return path
+
+
+class ThrottledHandler(http.server.BaseHTTPRequestHandler):
+    def __init__(self, *args, path, rate, **kwargs):
+        self.path_on_disk = path
+        self.rate = rate
+        super().__init__(*args, **kwargs)
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        with open(self.path_on_disk, "rb") as file:
+            data = file.read()
+        begin, end = 0, len(data) - 1
+        match = re.match(r"bytes=(\d*)-(\d*)", self.headers.get("Range", ""))
+        if match and (match.group(1) or match.group(2)):
+            if match.group(1):
+                begin = int(match.group(1))
+                if match.group(2):
+                    end = min(int(match.group(2)), end)
+            else:
+                begin = max(0, len(data) - int(match.group(2)))
+            self.send_response(206)
+            self.send_header("Content-Range", f"bytes {begin}-{end}/{len(data)}")
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", "video/mp4")
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("Content-Length", str(end - begin + 1))
+        self.end_headers()
+
+        # small chunks at a steady pace, the player sees a slow link rather than bursts
+        chunk = max(1024, int(self.rate / 20))
+        started = time.monotonic()
+        sent = 0
+        try:
+            for offset in range(begin, end + 1, chunk):
+                piece = data[offset:min(offset + chunk, end + 1)]
+                self.wfile.write(piece)
+                sent += len(piece)
+                delay = sent / self.rate - (time.monotonic() - started)
+                if delay > 0:
+                    time.sleep(delay)
+        except (BrokenPipeError, ConnectionResetError):
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("player")
+    parser.add_argument("--fixture")
+    parser.add_argument("--duration", type=float, default=12.0, help="of the fixture, seconds")
+    args = parser.parse_args()
+
+    if not os.environ.get("DISPLAY") and not os.environ.get("WAYLAND_DISPLAY"):
+        print("network_buffering: no display to open the player window on, skipped")
+        return SKIP
+
+    with tempfile.TemporaryDirectory() as directory:
+        fixture = args.fixture or make_fixture(directory, args.duration)
+        if fixture is None:
+            print("network_buffering: no --fixture and no ffmpeg to make one, skipped")
+            return SKIP
+
+        rate = os.path.getsize(fixture) / args.duration * RATE_FACTOR
+        handler = functools.partial(ThrottledHandler, path=fixture, rate=rate)
+        server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), handler)
+        server.daemon_threads = True
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        url = f"http://127.0.0.1:{server.server_address[1]}/{os.path.basename(fixture)}"
+        print(f"network_buffering: serving {url} at {rate / 1024:.0f} kB/s")
+
+        # the download takes duration / RATE_FACTOR, rebuffering adds at most the high watermark each time
+        timeout = args.duration / RATE_FACTOR + 60
+        command = [args.player, url, "-buffer", WATERMARKS, "-nothumbnails"]
+        # printf output is block buffered into a pipe, line buffering gets each line as it happens
+        if shutil.which("stdbuf"):
+            command = ["stdbuf", "-oL"] + command
+        player = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+
+        lines = []
+        finished = threading.Event()
+
+        def read_output():
+            for line in player.stdout:
+                line = line.rstrip("\n")
+                print(f"  | {line}")
+                lines.append(line)
+                if line.startswith("Playback finished"):
+                    finished.set()
+            finished.set()
+
+        threading.Thread(target=read_output, daemon=True).start()
+        finished.wait(timeout)
+        player.terminate()
+        try:
+            player.wait(timeout=10)
+        except subprocess.TimeoutExpired:
+            player.kill()
+        server.shutdown()
+
+    rebuffered = [i for i, line in enumerate(lines) if re.match(r"buffering, [\d.]+ s left", line)]
+    resumed = [i for i, line in enumerate(lines) if line.startswith("buffering done")]
+    failures = []
+    if not rebuffered:
+        failures.append("the player never ran dry and rebuffered")
+    elif not any(i > rebuffered[0] for i in resumed):
+        failures.append("the player didn't resume after rebuffering")
+    if not any(line.startswith("Playback finished") for line in lines):
+        failures.append(f"playback didn't reach the end within {timeout:.0f} s")
+
+    for failure in failures:
+        print(f"network_buffering: {failure}")
+    if not failures:
+        print(f"network_buffering: rebuffered {len(rebuffered)} times and played to the end")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())